@@ -0,0 +1,70 @@
+; MacBootMake bank 1 accessors
+;
+; bank 1 only holds basic variables, which are not used while the program
+; runs, so its RAM holds caches and the vic screen snapshot (segment
+; BANK1BSS, see macbootmake.cfg). the c code must never access that memory
+; directly, only via these two functions. they use the kernal's FETCH and
+; STASH, which run in common RAM, so the calling code can be anywhere.
+
+		.export	_bank1_fetch, _bank1_stash
+		.import	popax
+		.importzp	ptr1, ptr2, ptr3
+
+FETCH		= $ff74		; lda (A), y from bank X
+STASH		= $ff77		; sta (STAVEC), y to bank X
+STAVEC		= $02b9		; zp address of pointer for STASH
+BANK_RAM1	= 1		; kernal bank number
+
+; void __fastcall__ bank1_fetch(void *to, const void *from, unsigned int size)
+; copy from bank 1 to bank 0
+_bank1_fetch:	jsr	args
+		beq	@done
+@loop:			lda	#ptr2
+			ldx	#BANK_RAM1
+			jsr	FETCH
+			sta	(ptr1), y
+			jsr	next
+			bne	@loop
+@done:		rts
+
+; void __fastcall__ bank1_stash(void *to, const void *from, unsigned int size)
+; copy from bank 0 to bank 1
+_bank1_stash:	jsr	args
+		beq	@done
+		lda	#ptr1
+		sta	STAVEC
+@loop:			lda	(ptr2), y
+			ldx	#BANK_RAM1
+			jsr	STASH
+			jsr	next
+			bne	@loop
+@done:		rts
+
+; get arguments: ptr1 = to, ptr2 = from, ptr3 = size
+; returns with Y = 0 and Z set if size is zero
+args:		sta	ptr3
+		stx	ptr3 + 1
+		jsr	popax
+		sta	ptr2
+		stx	ptr2 + 1
+		jsr	popax
+		sta	ptr1
+		stx	ptr1 + 1
+		ldy	#0
+		lda	ptr3
+		ora	ptr3 + 1
+		rts
+
+; advance index (and pointers every 256 bytes), count down size
+; returns with Z set if size has reached zero
+next:		iny
+		bne	:+
+			inc	ptr1 + 1
+			inc	ptr2 + 1
+:		lda	ptr3
+		bne	:+
+			dec	ptr3 + 1
+:		dec	ptr3
+		lda	ptr3
+		ora	ptr3 + 1
+		rts
@@ -0,0 +1,781 @@
+// boot block core, see bbcore.h
+#include <stddef.h>
+#include <string.h>
+#include "bbcore.h"
+
+// drive/partition types:
+struct dpt	dpt_1541	= {1, 1, "18 0", "5",  "1541/1571",	20};
+struct dpt	dpt_ieee	= {1, 1, "38 0", "7",  "SFD/8050/8250",	28};
+struct dpt	dpt_1581	= {1, 1, "40 1", "17", "1581",	39};
+struct dpt	dpt_cmdnative	= {1, 0, NULL,   NULL, "CMD native",	0};	// track 1 holds header and BAM
+struct dpt	dpt_cmdextnat	= {1, 0, NULL,   NULL, "CMD extended native",	0};
+struct dpt	dpt_rawsd2iec	= {1, 0, NULL,   NULL, "raw SD2IEC",	0};
+struct dpt	dpt_unknown	= {0, 0, NULL,   NULL, "unknown",	0};
+// TODO: add Slave2CBM
+
+// globals:
+const struct transport	*transport;
+struct dpt	*dpt;	// disk/partition type
+bool		bootblock_active;	// flag: contents start with "cbm"
+enum as		allocation_state;	// ternary (free/allocated/dontcarebecausereserved)
+uint8_t		bam_bits[5];	// allocation bits of track 1 (if dpt->fiddle_with_bam)
+uint8_t		old_preload_count;	// number of sectors preloaded by existing boot block
+struct conf	conf;
+char		filename_buf[FILENAME_BUF_LEN];
+char		message_buffer[MSG_BUF_LEN];
+uint8_t		message_len;
+uint8_t		preload_count;	// zero for "no extra sectors"
+uint16_t	preload_addr;	// where to put them
+uint8_t		preload_bank;	// ...and in which bank
+const char	*preload_data;	// data to write to those sectors
+uint16_t	embed_len;	// number of bytes after load address
+uint8_t		buf_used	= 0;
+char		buffer[BUFFER_MAX + 1];
+
+// string literals end up in petscii when compiled by cc65. host compilers
+// use ascii, so convert text (commands, file names, basic text) when adding
+// it to the buffer. (raw bytes like the "cbm" signature are given as hex.)
+#ifdef __CC65__
+#define petscii(cc)	(cc)
+#else
+static uint8_t petscii(uint8_t cc)
+{
+	if (cc >= 'a' && cc <= 'z')
+		return cc - 0x20;	// unshifted letters
+	if (cc >= 'A' && cc <= 'Z')
+		return cc + 0x80;	// shifted letters
+	if (cc == '\n')
+		return 13;
+	return cc;
+}
+#endif
+
+// add a single byte
+void __fastcall__ buf_add_byte(uint8_t cc)
+{
+	if (buf_used >= BUFFER_MAX)
+		return;
+	buffer[buf_used] = cc;
+	++buf_used;
+}
+
+// add a sequence of bytes (may contain zeroes)
+void __fastcall__ buf_add_seq(uint8_t size, const char *buf)
+{
+	while (size--)
+		buf_add_byte(*buf++);
+}
+
+// add a terminated string
+void __fastcall__ buf_add_string(const char *string)
+{
+	static unsigned int	length;
+
+	length = 0;
+	while (string[length] != '\0')
+		++length;
+	if (length > BUFFER_MAX)
+		length = BUFFER_MAX;
+	while (length--)
+		buf_add_byte(petscii(*string++));
+}
+
+// add decimal representation of unsigned byte
+void __fastcall__ buf_add_uint8dec99max(uint8_t byte)
+{
+	char	result[2];
+
+#ifdef __CC65__
+	// this code relies on cc65's argument stack handling...
+	(void) byte;	// inhibit compiler warning
+	asm(
+"		ldy #2		\n"
+"		lda (sp), y	\n"	// read parameter
+"		jsr $f9fb	\n"	// $f9fb converts uint8 in A to two ascii digits in XXAA (so only works in 0..99 range)
+"		ldy #1		\n"
+"		sta (sp), y	\n"	// write result[1]
+"		txa		\n"
+"		dey		\n"
+"		sta (sp), y	\n"	// write result[0]
+	);
+#else
+	result[0] = '0' + byte / 10 % 10;
+	result[1] = '0' + byte % 10;
+#endif
+	// inhibit leading zero
+	if (result[0] == '0')
+		buf_add_byte(result[1]);
+	else
+		buf_add_seq(2, result);
+}
+
+// add prefix codes (according to config) and actual message
+static const char	string_epej[]	= { c_ESCAPE, 'p', c_ESCAPE, 'j', 0 };
+void buf_add_message(void)
+{
+	if (conf.remove_boot_msg)
+		buf_add_string(string_epej);
+	if (conf.lock_charset)
+		buf_add_byte(c_LOCK);
+	switch (conf.force_case) {
+	case FORCE_NONE:
+		break;
+	case FORCE_LOWER:
+		buf_add_byte(c_LOWERCASE);
+		break;
+	case FORCE_UPPER:
+		buf_add_byte(c_UPPERCASE);
+		break;
+	default:
+		break;
+	}
+	buf_add_seq(message_len, message_buffer);
+}
+
+// check disc/partition type
+// result is in global var; returns true on error or unsupported drive
+bool drive_get_dpt(void)
+{
+	static int	format;
+
+	bb_print("Checking drive/partition format.\n");
+	format = transport->format();
+	if (format == -1)
+		return 1;	// fail
+
+	if (transport->status())
+		return 1;	// fail
+
+	// dos format indicator, in petscii
+	switch (format) {
+	case 0x41:	// "a"
+		dpt = &dpt_1541;
+		break;
+	case 0x43:	// "c"
+		dpt = &dpt_ieee;
+		break;
+	case 0x44:	// "d"
+		dpt = &dpt_1581;
+		break;
+	case 0x48:	// "h"
+		dpt = &dpt_cmdnative;
+		break;
+	case 0x4d:	// "m"
+		dpt = &dpt_cmdextnat;
+		break;
+	case 0x00:
+		dpt = &dpt_rawsd2iec;
+		break;
+	default:
+		dpt = &dpt_unknown;
+		break;
+	}
+	bb_print("  Drive/partition has ");
+	bb_print(dpt->name);
+	bb_print(" format.\n");
+	if (dpt->valid)
+		return 0;	// ok
+
+	bb_print("Sorry.\n\n");	// don't mess with unknown formats
+	return 1;	// fail
+}
+
+// boot code generator:
+// the boot sector gets loaded to $0b00 and the code after the file name
+// terminator is called via JSR, so code addresses depend on buffer position.
+#define buf_pc()	(BOOTSECTOR_ADDR + buf_used)
+// opcodes
+#define OPC_BCS		0xb0
+#define OPC_BPL		0x10
+#define OPC_CLI		0x58
+#define OPC_DEX		0xca
+#define OPC_JMP		0x4c
+#define OPC_JSR		0x20
+#define OPC_LDA_ABSX	0xbd
+#define OPC_LDA_IMM	0xa9
+#define OPC_LDA_ZP	0xa5
+#define OPC_LDX_IMM	0xa2
+#define OPC_LDX_ZP	0xa6
+#define OPC_LDY_IMM	0xa0
+#define OPC_LDY_ZP	0xa4
+#define OPC_RTS		0x60
+#define OPC_SEI		0x78
+#define OPC_STA_ABS	0x8d
+#define OPC_STA_ABSX	0x9d
+#define OPC_STA_ZP	0x85
+#define OPC_STX_ZP	0x86
+#define OPC_STX_ABS	0x8e
+#define OPC_STY_ABS	0x8c
+// kernal/basic entry points used by boot code
+#define KERNAL_SETBNK	0xff68
+#define KERNAL_JMPFAR	0xff71
+#define KERNAL_SETLFS	0xffba
+#define KERNAL_SETNAM	0xffbd
+#define KERNAL_LOAD	0xffd5
+#define BASIC_LINKPRG	0x4f4f	// re-link program lines
+#define BASIC_EXECUTE	0xafa5	// execute text at X/Y + 1
+#define ZP_FARBANK	0x02	// JMPFAR parameters: bank,
+#define ZP_FARPC	0x03	//	address (high byte first!),
+#define ZP_FARSR	0x05	//	status register
+#define ZP_TXTTAB	0x2d	// start of basic text
+#define ZP_JIFFY	0xa0	// jiffy clock, three bytes, high byte first
+#define ZP_SAL		0xac	// LOAD leaves start address of loaded data here
+#define ZP_FA		0xba	// current device (the boot device, at boot time)
+#define BASIC_TEXTTOP	0x1210	// end of basic text
+// cia 2 timers, used to measure the time until the program starts
+#define CIA2_TIMER	0xdd04	// timer a and b, low byte first
+#define CIA2_CRA	0xdd0e
+#define CIA2_CRB	0xdd0f
+#define CIA_CR_START	0x11	// start, force load, count clock cycles
+#define CIA_CR_CASCADE	0x51	// start, force load, count timer a underflows
+
+// add 6502 instruction with byte argument
+static void __fastcall__ buf_add_opb(uint8_t opcode, uint8_t arg)
+{
+	buf_add_byte(opcode);
+	buf_add_byte(arg);
+}
+
+// add 6502 instruction with word argument
+static void __fastcall__ buf_add_opw(uint8_t opcode, uint16_t arg)
+{
+	buf_add_byte(opcode);
+	buf_add_byte(arg);
+	buf_add_byte(arg >> 8);
+}
+
+// add code to copy jiffy clock to timing record (see TIMING_ADDR)
+static void __fastcall__ buf_add_jiffy_store(uint8_t offset)
+{
+	static uint8_t	ii;
+
+	buf_add_byte(OPC_SEI);	// so the three bytes belong together
+	for (ii = 0; ii < 3; ++ii) {
+		buf_add_opb(OPC_LDA_ZP, ZP_JIFFY + ii);
+		buf_add_opw(OPC_STA_ABS, TIMING_ADDR + offset + ii);
+	}
+	buf_add_byte(OPC_CLI);
+}
+
+// add "dex, bpl" back to buffer index "loop"
+static void __fastcall__ buf_add_loop_end(uint8_t loop)
+{
+	buf_add_byte(OPC_DEX);
+	buf_add_opb(OPC_BPL, loop - buf_used - 2);
+}
+
+// add code to start timing record (if wanted)
+static void buf_add_timing_entry(void)
+{
+	static uint8_t	loop;
+
+	if (conf.timing == TIMING_OFF)
+		return;
+
+	buf_add_opb(OPC_LDA_IMM, TIMING_MAGIC);
+	buf_add_opw(OPC_STA_ABS, TIMING_ADDR);
+	buf_add_opb(OPC_LDA_IMM, (uint8_t) ~TIMING_MAGIC);
+	buf_add_opw(OPC_STA_ABS, TIMING_ADDR + 1);
+	buf_add_jiffy_store(TIMING_ENTRY_OFFSET);
+	// clear timer value ("not recorded")
+	buf_add_opb(OPC_LDA_IMM, 0);
+	buf_add_opb(OPC_LDX_IMM, 3);
+	loop = buf_used;
+	buf_add_opw(OPC_STA_ABSX, TIMING_ADDR + TIMING_START_OFFSET);
+	buf_add_loop_end(loop);
+	if (conf.timing != TIMING_START)
+		return;
+
+	// start cia 2 timers as one 32-bit counter, from $ffffffff down
+	buf_add_opb(OPC_LDA_IMM, 0xff);
+	buf_add_opb(OPC_LDX_IMM, 3);
+	loop = buf_used;
+	buf_add_opw(OPC_STA_ABSX, CIA2_TIMER);
+	buf_add_loop_end(loop);
+	buf_add_opb(OPC_LDA_IMM, CIA_CR_CASCADE);
+	buf_add_opw(OPC_STA_ABS, CIA2_CRB);
+	buf_add_opb(OPC_LDA_IMM, CIA_CR_START);
+	buf_add_opw(OPC_STA_ABS, CIA2_CRA);
+}
+
+// add code to record start of program (if wanted):
+// stop timer a (so timer b stops as well) and copy both to timing record
+static void buf_add_timing_start(void)
+{
+	static uint8_t	loop;
+
+	if (conf.timing != TIMING_START)
+		return;
+
+	buf_add_opb(OPC_LDA_IMM, 0);
+	buf_add_opw(OPC_STA_ABS, CIA2_CRA);
+	buf_add_opb(OPC_LDX_IMM, 3);
+	loop = buf_used;
+	buf_add_opw(OPC_LDA_ABSX, CIA2_TIMER);
+	buf_add_opw(OPC_STA_ABSX, TIMING_ADDR + TIMING_START_OFFSET);
+	buf_add_loop_end(loop);
+}
+
+// add code to set end of basic text to X/Y, re-link and let interpreter do "bank:run"
+// text must be added afterwards using buf_add_runbasic_text()
+static uint8_t	text_lo;	// buffer index of basic text pointer's low byte
+static void buf_add_runbasic(void)
+{
+	buf_add_opw(OPC_STX_ABS, BASIC_TEXTTOP);
+	buf_add_opw(OPC_STY_ABS, BASIC_TEXTTOP + 1);
+	buf_add_opw(OPC_JSR, BASIC_LINKPRG);
+	text_lo = buf_used + 1;
+	buf_add_opb(OPC_LDX_IMM, 0);	// will be fixed in buf_add_runbasic_text()
+	buf_add_opb(OPC_LDY_IMM, BOOTSECTOR_ADDR >> 8);
+	buf_add_opw(OPC_JMP, BASIC_EXECUTE);
+}
+
+// add basic text to execute for running basic programs
+void buf_add_runtext(void)
+{
+	buf_add_string("bA");	// bank
+	buf_add_uint8dec99max(conf.chosen_bank);
+	buf_add_string(":rU");	// run
+	buf_add_byte(0);	// end of basic line
+}
+
+// add text for the code above
+static void buf_add_runbasic_text(void)
+{
+	// calling $afa5 will increment pointer before using it
+	buffer[text_lo] = buf_pc() - 1;
+	buf_add_runtext();
+}
+
+// add code to jump to address in A/X (high/low) in chosen bank
+static void buf_add_jmpfar(void)
+{
+	buf_add_opb(OPC_STA_ZP, ZP_FARPC);
+	buf_add_opb(OPC_STX_ZP, ZP_FARPC + 1);
+	buf_add_opb(OPC_LDA_IMM, conf.chosen_bank);
+	buf_add_opb(OPC_STA_ZP, ZP_FARBANK);
+	buf_add_opb(OPC_LDA_IMM, 0);
+	buf_add_opb(OPC_STA_ZP, ZP_FARSR);
+	buf_add_opw(OPC_JMP, KERNAL_JMPFAR);
+}
+
+// add code to load file (RUNBASIC/BOOTMC actions)
+static void buf_add_load(void)
+{
+	static uint8_t	name_lo,	// buffer index of name pointer's low byte
+			branch;		// buffer index of branch offset
+
+	// basic programs go to bank 0, machine code to chosen bank
+	buf_add_opb(OPC_LDA_IMM, (conf.action == ACTION_RUNBASIC) ? 0 : conf.chosen_bank);
+	buf_add_opb(OPC_LDX_IMM, 0);	// file name is in bank 0
+	buf_add_opw(OPC_JSR, KERNAL_SETBNK);
+	buf_add_opb(OPC_LDA_IMM, strlen(filename_buf));
+	name_lo = buf_used + 1;
+	buf_add_opb(OPC_LDX_IMM, 0);	// will be fixed below
+	buf_add_opb(OPC_LDY_IMM, BOOTSECTOR_ADDR >> 8);
+	buf_add_opw(OPC_JSR, KERNAL_SETNAM);
+	buf_add_opb(OPC_LDA_IMM, 0);	// logical file number does not matter for LOAD
+	if (conf.alternative_device == ALTDEVICE_NONE)
+		buf_add_opb(OPC_LDX_ZP, ZP_FA);
+	else
+		buf_add_opb(OPC_LDX_IMM, conf.alternative_device);
+	// basic: use secondary address 0 to load to start of basic text,
+	// machine code: use 1 to load to address given in file.
+	buf_add_opb(OPC_LDY_IMM, (conf.action == ACTION_RUNBASIC) ? 0 : 1);
+	buf_add_opw(OPC_JSR, KERNAL_SETLFS);
+	buf_add_opb(OPC_LDA_IMM, 0);	// 0 means LOAD, not VERIFY
+	buf_add_opb(OPC_LDX_ZP, ZP_TXTTAB);	// only used for secondary address 0
+	buf_add_opb(OPC_LDY_ZP, ZP_TXTTAB + 1);
+	buf_add_opw(OPC_JSR, KERNAL_LOAD);
+	branch = buf_used + 1;
+	buf_add_opb(OPC_BCS, 0);	// will be fixed below
+	buf_add_timing_start();
+	if (conf.action == ACTION_RUNBASIC) {
+		buf_add_runbasic();
+	} else {
+		// jump to start of loaded data
+		buf_add_opb(OPC_LDA_ZP, ZP_SAL + 1);
+		buf_add_opb(OPC_LDX_ZP, ZP_SAL);
+		buf_add_jmpfar();
+	}
+	buffer[branch] = buf_used - branch - 1;
+	buf_add_byte(OPC_RTS);	// if LOAD fails, just return to basic
+	buffer[name_lo] = buf_pc();
+	buf_add_string(filename_buf);
+	if (conf.action == ACTION_RUNBASIC)
+		buf_add_runbasic_text();
+}
+
+// add code to start embedded program (EMBED action)
+static void buf_add_embedded_start(void)
+{
+	static uint16_t	end;
+
+	buf_add_timing_start();
+	if (preload_addr == BASIC_START) {
+		end = BASIC_START + embed_len;
+		buf_add_opb(OPC_LDX_IMM, end);
+		buf_add_opb(OPC_LDY_IMM, end >> 8);
+		buf_add_runbasic();
+		buf_add_runbasic_text();
+	} else {
+		buf_add_opb(OPC_LDA_IMM, preload_addr >> 8);
+		buf_add_opb(OPC_LDX_IMM, preload_addr);
+		buf_add_jmpfar();
+	}
+}
+
+// build the new boot block in memory
+// returns true if it does not fit
+static const char	part1[]	= { 0x43, 0x42, 0x4d };	// "cbm" in petscii
+static const char	part2[]	= { 0, 0 };	// text terminator, filename terminator
+bool bootblock_build(void)
+{
+	// put version msg at end of buffer
+	buf_used = 198;	// the string below takes 56 chars
+	buf_add_string(" This boot block was created by MacBootMake Version " VERSION ".\n");
+	// now create real data at start of buffer. version message may be overwritten, but that's ok.
+	buf_used = 0;	// clear buffer
+	buf_add_seq(3, part1);
+	// tell kernal which sectors to preload (address, bank, count)
+	buf_add_byte(preload_addr);
+	buf_add_byte(preload_addr >> 8);
+	buf_add_byte(preload_bank);
+	buf_add_byte(preload_count);
+	buf_add_message();
+	buf_add_seq(2, part2);
+	// boot code starts here.
+	if (conf.use_local_charset) {
+		buf_add_opb(OPC_LDA_IMM, 0x6f);	// set bit 6 to output
+		buf_add_opb(OPC_STA_ZP, 0x00);
+		buf_add_opb(OPC_LDA_IMM, 0x33);	// and pull down
+		buf_add_opb(OPC_STA_ZP, 0x01);
+	}
+	buf_add_timing_entry();
+	switch (conf.action) {
+	case ACTION_RUNBASIC:
+	case ACTION_BOOTMC:
+		buf_add_load();
+		break;
+	case ACTION_EMBED:
+		buf_add_embedded_start();
+		break;
+	case ACTION_BURSTLOAD:
+	case ACTION_FASTLOAD:
+	case ACTION_GO64LOAD:
+	case ACTION_MENU:
+	case ACTION_PACKED:
+		buf_add_opw(OPC_JMP, LOADER_ADDR);
+		break;
+	default:
+		break;
+	}
+	if (buf_used >= BUFFER_MAX)
+		return 1;	// fail
+
+	// timing record goes to end of sector
+	if (conf.timing != TIMING_OFF && buf_used > 256 - TIMING_SIZE)
+		return 1;	// fail
+
+	buf_used = MSG_BUF_LEN;	// make sure whole buffer is sent to drive
+	return 0;	// ok
+}
+
+// set drive buffer pointer (channels must be open, argument must be given as string)
+static bool __fastcall__ set_buffer_pointer(const char *byte_offset)
+{
+	buf_used = 0;	// clear buffer
+	buf_add_string("b-p " XSTR(SA_BUF) " ");
+	buf_add_string(byte_offset);
+	return transport->command(buffer, buf_used);
+}
+
+// send buffer contents to command channel and display drive status
+// return true on error
+static bool send_and_check(void)
+{
+	if (transport->command(buffer, buf_used))
+		return 1;	// fail
+
+	if (transport->status())
+		return 1;	// fail
+
+	return 0;	// ok
+}
+
+// send block command (read/write) to disk drive (channels must be open)
+// track and sector must be given as string (space- or semicolon-separated)
+static bool __fastcall__ block_usercmd(uint8_t action, const char *ts)
+{
+	buf_used = 0;	// clear buffer
+	buf_add_byte(petscii('u'));
+	buf_add_byte(action);
+	buf_add_string(" " XSTR(SA_BUF) " 0 ");	// 0 is drive
+	buf_add_string(ts);
+	return send_and_check();
+}
+
+// tell disk drive to read a block into buffer
+// track and sector must be given as string (space- or semicolon-separated)
+#define block_read(ts)	block_usercmd('1', ts)
+
+// tell disk drive to write buffer to block
+// track and sector must be given as string (space- or semicolon-separated)
+#define block_write(ts)	block_usercmd('2', ts)
+
+// tell disk drive to write buffer to sector on track 1
+static bool __fastcall__ block_write_t1(uint8_t sector)
+{
+	buf_used = 0;	// clear buffer
+	buf_add_string("u2 " XSTR(SA_BUF) " 0 1 ");	// 0 is drive, 1 is track
+	buf_add_uint8dec99max(sector);
+	return send_and_check();
+}
+
+// send "b-a" or "b-f" command for sector on track 1
+// return true on error
+static bool __fastcall__ block_bam(const char *cmd, uint8_t sector)
+{
+	buf_used = 0;
+	buf_add_string(cmd);
+	buf_add_string(" 0 1 ");	// 0 is drive, 1 is track
+	buf_add_uint8dec99max(sector);
+	return send_and_check();
+}
+
+// try to allocate t1s0
+// return true on error
+static bool bootblock_allocate(void)
+{
+	bb_print("Allocating boot block.\n");
+	return block_bam("b-a", 0);
+}
+
+// try to free t1s0
+// return true on error
+static bool bootblock_free(void)
+{
+	bb_print("Deallocating boot block.\n");
+	return block_bam("b-f", 0);
+}
+
+// check whether boot block is allocated and active:
+// result is in global vars; returns true on error!
+static bool bootblock_check(void)
+{
+	static uint8_t	header[7];
+
+	if (dpt->fiddle_with_bam) {
+		bb_print("Checking BAM.\n");
+		if (block_read(dpt->track_and_sector))
+			return 1;	// fail
+
+		if (set_buffer_pointer(dpt->byte_offset))
+			return 1;	// fail
+
+		if (transport->read(bam_bits, sizeof(bam_bits)))
+			return 1;	// fail
+
+		// boot block is sector 0, so check lsb:
+		if (bam_bits[0] & 1) {
+			allocation_state = AS_FREE;
+			bb_print("  Boot block is not allocated.\n");
+		} else {
+			allocation_state = AS_ALLOCATED;
+			bb_print("  Boot block is allocated.\n");
+		}
+	} else {
+		allocation_state = AS_RESERVED;
+		// FIXME - tell user why we don't care about allocation!
+	}
+	// check whether boot block is active:
+	bb_print("Reading boot block.\n");
+	if (block_read("1 0"))
+		return 1;	// fail
+
+	// set buffer pointer to zero
+	// FIXME - check whether old version works, because this was added!
+	if (set_buffer_pointer("0"))
+		return 1;	// fail
+
+	if (transport->read(header, 7))
+		return 1;	// fail
+
+	bootblock_active = memcmp(header, part1, sizeof(part1)) == 0;
+	// remember which sectors are in use by an active boot block
+	old_preload_count = 0;
+	if (bootblock_active && (header[6] <= dpt->preload_max))
+		old_preload_count = header[6];
+	return 0;	// ok
+}
+
+// check whether sectors to preload may be used
+// (existing boot block and BAM must have been checked)
+// returns true if not
+#define sector_is_free(s)	(bam_bits[(s) >> 3] & (1 << ((s) & 7)))
+static bool preload_check(void)
+{
+	static uint8_t	ss;
+
+	if (preload_count == 0)
+		return 0;	// ok
+
+	if (preload_count > dpt->preload_max) {
+		bb_error("Cannot preload that many sectors on this format");
+		return 1;	// fail
+	}
+	// sectors used by existing boot block may be overwritten, all others must be free
+	for (ss = old_preload_count + 1; ss <= preload_count; ++ss) {
+		if (!sector_is_free(ss)) {
+			bb_error("Sectors for preloading are in use");
+			return 1;	// fail
+		}
+	}
+	return 0;	// ok
+}
+
+// write sectors to preload (buffer channel must be open)
+// returns true on error
+static bool preload_write(void)
+{
+	static uint8_t	ss;
+
+	if (preload_count)
+		bb_print("Writing preloaded sectors");
+	for (ss = 1; ss <= preload_count; ++ss) {
+		bb_print(".");	// progress
+		if (set_buffer_pointer("0"))
+			return 1;	// fail
+
+		if (transport->write(preload_data + ((ss - 1) << 8), 256))
+			return 1;	// fail
+
+		if (block_write_t1(ss))
+			return 1;	// fail
+	}
+	if (preload_count)
+		bb_print("\n");
+	return 0;	// ok
+}
+
+// allocate preloaded sectors and free those the old boot block used but the
+// new one does not need
+// returns true on error
+static bool preload_update_bam(void)
+{
+	static uint8_t	ss,
+			top;
+
+	if (dpt->fiddle_with_bam == 0)
+		return 0;	// ok
+
+	top = (preload_count > old_preload_count) ? preload_count : old_preload_count;
+	if (top)
+		bb_print("Updating BAM for preloaded sectors.\n");
+	for (ss = 1; ss <= top; ++ss) {
+		if (ss <= preload_count) {
+			if (sector_is_free(ss) && block_bam("b-a", ss))
+				return 1;	// fail
+		} else {
+			if (!sector_is_free(ss) && block_bam("b-f", ss))
+				return 1;	// fail
+		}
+	}
+	return 0;	// ok
+}
+
+// create boot block (channels must be open, dpt and preloading must be set)
+// returns true on error or if user cancelled
+bool bootblock_create(void)
+{
+	if (bootblock_check())
+		return 1;	// fail
+
+	if (preload_check())
+		return 1;	// fail
+
+	if (bootblock_active) {
+		if (bb_cancel(BBQ_OVERWRITE))
+			return 1;	// cancelled
+
+	} else {
+		if ((dpt->fiddle_with_bam) && (allocation_state == AS_ALLOCATED)) {
+			if (bb_cancel(BBQ_DATALOSS))
+				return 1;	// cancelled
+
+		}
+	}
+	if (preload_write())
+		return 1;	// fail
+
+	if (set_buffer_pointer("0"))
+		return 1;	// fail
+
+	bb_print("Writing boot block.\n");
+	if (bootblock_build()) {
+		bb_error("Message too long");
+		return 1;	// fail
+	}
+	if (transport->write(buffer, buf_used))
+		return 1;	// fail
+
+	if (block_write("1 0"))
+		return 1;	// fail
+
+	if ((dpt->fiddle_with_bam) && (allocation_state == AS_FREE)) {
+		if (bootblock_allocate())
+			return 1;	// fail
+	}
+	if (preload_update_bam())
+		return 1;	// fail
+
+	bb_print("Done.\n");
+	return 0;	// ok
+}
+
+// check/destroy boot block (channels must be open, dpt must be set)
+// returns true on error or if user cancelled
+bool bootblock_remove(void)
+{
+	static uint8_t	zero	= 0;
+
+	if (bootblock_check())
+		return 1;	// fail
+
+	if (bootblock_active == 0) {
+		bb_print("  No active boot block.\n");
+		// TODO - if allocated, ask user whether to free?
+		return 0;	// ok, nothing to do
+	}
+	bb_print("  Boot block found.\n");
+	// FIXME - if block is free, ask user whether to allocate!
+	if (bb_cancel(BBQ_REMOVE))
+		return 1;	// cancelled
+
+	// ok, now destroy it
+	if (set_buffer_pointer("0"))
+		return 1;	// fail
+
+	if (transport->write(&zero, 1))	// overwriting first byte should be enough
+		return 1;	// fail
+
+	//print#LFN_CMD, "b-p " XSTR(SA_BUF) " 0"	this is useless, as i now realize. a data becker book said to do this...
+	if (block_write("1 0"))
+		return 1;	// fail
+
+	bb_print("  Boot block deactivated.\n");
+	if ((dpt->fiddle_with_bam) && (allocation_state == AS_ALLOCATED)) {
+// FIXME - ask user, maybe they want to keep it allocated for later use!
+// but then, how do we recognize this the next time and do not scare user about data loss?
+// maybe use special "disabled" boot sector contents?
+		if (bootblock_free())
+			return 1;	// fail
+	}
+	// preloaded sectors are no longer needed
+	preload_count = 0;
+	if (preload_update_bam())
+		return 1;	// fail
+
+	bb_print("Done.\n");
+	return 0;	// ok
+}
@@ -0,0 +1,182 @@
+// boot block core: drive/partition types, boot block config, boot code
+// generator and the checking/writing/removing of boot blocks.
+// this does not depend on cc65 or the c128, so it can also be built with a
+// host compiler. drive access goes through a transport (see transport.h),
+// output and questions go through the bb_* functions at the end, which each
+// program using the core must provide.
+#ifndef bbcore_H
+#define bbcore_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "transport.h"
+
+#define VERSION	"12"
+#define DATE	"19 Oct"
+#define YEAR	"2026"
+
+#ifndef __CC65__
+#define __fastcall__
+#endif
+
+// needed to put number in string:
+#define STR(x)	#x	// stringize
+#define XSTR(x)	STR(x)	// expand, then stringize
+// control codes (cc65 seems to garble some of them when inside strings, so don't put them there)
+#define c_STOP		3
+#define c_CONTROL_D	4	// used in menu for "scan for next device"
+#define c_BELL		0x07	// C128 only!
+#define c_LOCK		0x0b	// C128 only! C64 uses 8!
+#define c_UNLOCK	0x0c	// C128 only! C64 uses 9!
+#define c_RETURN	0x0d
+#define c_CRSR_DOWN	0x11
+#define c_HOME		0x13
+#define c_CLEAR		0x93
+#define c_LOWERCASE	0x0e
+#define c_UPPERCASE	0x8e
+#define c_ESCAPE	0x1b	// C128 only!
+#define c_RVSON		0x12
+#define c_CRSR_UP	0x91
+#define c_RVSOFF	0x92
+
+// drive/partition types:
+struct dpt {
+	uint8_t	valid;	// so "unknown" entry forbids action
+	uint8_t	fiddle_with_bam;	// set if allocation/freeing must be done
+	char	*track_and_sector;	// where to find allocation byte
+	char	*byte_offset;		// byte offset in sector (and then use its lsb)
+	char	*name;	// symbolic name to display
+	uint8_t	preload_max;	// number of sectors after T1S0 that can be preloaded
+};
+extern struct dpt	dpt_1541,
+			dpt_ieee,
+			dpt_1581,
+			dpt_cmdnative,
+			dpt_cmdextnat,
+			dpt_rawsd2iec,
+			dpt_unknown;
+extern struct dpt	*dpt;	// disk/partition type
+
+// state of disc, see bootblock_check()
+enum as {	// ternary for allocation state:
+	AS_FREE,	// free for files
+	AS_ALLOCATED,	// marked as used in BAM
+	AS_RESERVED	// drive/partition reserves T1S0, so no need to check/alloc/free!
+};
+extern bool		bootblock_active;	// flag: contents start with "cbm"
+extern enum as		allocation_state;	// ternary (free/allocated/dontcarebecausereserved)
+extern uint8_t		bam_bits[5];	// allocation bits of track 1 (if dpt->fiddle_with_bam)
+extern uint8_t		old_preload_count;	// number of sectors preloaded by existing boot block
+
+// boot block config:
+enum action {	// what to do when booting
+	ACTION_RUNBASIC,
+	ACTION_BOOTMC,
+	ACTION_EMBED,	// program is in preloaded sectors
+	ACTION_BURSTLOAD,	// burst loader is in preloaded sectors
+	ACTION_FASTLOAD,	// loader for drive family is in preloaded sectors
+	ACTION_GO64LOAD,	// c64 loader is in preloaded sectors
+	ACTION_MENU,	// menu, file list and loader are in preloaded sectors
+	ACTION_PACKED,	// loader for packed program is in preloaded sectors
+	ACTIONLIMIT
+};
+enum drivemode {	// what to send to drive before going to c64 mode
+	DRIVEMODE_KEEP,
+	DRIVEMODE_1541,	// "u0>m0"
+	DRIVEMODE_1571,	// "u0>m1"
+	DRIVEMODELIMIT
+};
+enum forcecase {	// which charset to use
+	FORCE_NONE,
+	FORCE_LOWER,
+	FORCE_UPPER,
+	FORCELIMIT
+};
+enum timing {	// what boot code records, see TIMING_ADDR
+	TIMING_OFF,
+	TIMING_ENTRY,	// jiffy clock when boot code starts
+	TIMING_START,	// ...and when loaded program is started
+	TIMINGLIMIT
+};
+struct conf {
+	bool		remove_boot_msg;
+	bool		lock_charset;
+	enum forcecase	force_case;
+	bool		use_local_charset;
+	enum action	action;	// what to do: RUN file or BOOT file or GO64?
+	uint8_t		alternative_device;	// from where to load file?
+	uint8_t		chosen_bank;	// bank in which to run machine code
+	enum drivemode	drive_mode;	// for c64 programs
+	enum timing	timing;	// record boot timing?
+};
+extern struct conf	conf;
+#define ALTDEVICE_NONE	31	// this value is used for "use boot device", i.e. "do NOT use an alternative device"
+#define FILENAME_BUF_LEN	17	// 16 chars plus terminator
+extern char		filename_buf[FILENAME_BUF_LEN];
+#define MSG_BUF_LEN	255	// 254 chars plus terminator
+extern char		message_buffer[MSG_BUF_LEN];
+extern uint8_t		message_len;
+// extra sectors the kernal loads from T1S1..T1Sn before calling boot code:
+#define PRELOAD_MAX	20	// 1541 has 21 sectors on track 1
+extern uint8_t		preload_count;	// zero for "no extra sectors"
+extern uint16_t		preload_addr;	// where to put them
+extern uint8_t		preload_bank;	// ...and in which bank
+extern const char	*preload_data;	// data to write to those sectors
+// embedded program:
+#define BASIC_START	0x1c01	// programs with this load address are run as basic
+extern uint16_t		embed_len;	// number of bytes after load address
+// the boot sector gets loaded here, the loader images go after it:
+#define BOOTSECTOR_ADDR	0x0b00
+#define LOADER_ADDR	0x1300	// must match bootcode.s
+
+// boot timing record, written by boot code (and loaders) if conf.timing is
+// set. it is at the end of the boot sector's page, which no bootable program
+// can overlap (the boot code must not end there, and the loaders refuse files
+// that would reach it), so it is still there when the booted program (or
+// macbootmake) runs:
+//	+0, +1	TIMING_MAGIC and its complement, if record is valid
+//	+2..+4	jiffy clock ($a0..$a2, high byte first) at start of boot code
+//	+5..+8	cia 2 timers a and b (low byte first) just before starting the
+//		loaded program, zero if not recorded (c64 programs, or
+//		TIMING_ENTRY)
+// the jiffy clock counts 1/60 seconds since reset, but pauses while
+// interrupts are disabled, so the first value is only a lower limit.
+// the interval up to the program start does not depend on interrupts: the
+// boot code starts both timers as a 32-bit counter of system clock cycles
+// (counting down from $ffffffff), and the program start stops it.
+#define TIMING_MAGIC	0x54
+#define TIMING_ENTRY_OFFSET	2
+#define TIMING_START_OFFSET	5
+#define TIMING_SIZE	9
+#define TIMING_ADDR	(BOOTSECTOR_ADDR + 256 - TIMING_SIZE)	// must match bootcode.s
+
+// replacement for basic's string handling: use a global buffer and functions
+// to append various stuff
+#define BUFFER_MAX	((uint8_t) 255)	// content length may be 0..255
+extern uint8_t		buf_used;
+extern char		buffer[BUFFER_MAX + 1];	// but buffer is a full page so terminator can be added
+void __fastcall__ buf_add_byte(uint8_t cc);
+void __fastcall__ buf_add_seq(uint8_t size, const char *buf);
+void __fastcall__ buf_add_string(const char *string);
+void __fastcall__ buf_add_uint8dec99max(uint8_t byte);
+void buf_add_message(void);
+void buf_add_runtext(void);
+
+// functions that return bool return true on error (after reporting it)
+extern const struct transport	*transport;	// must be set before calling these
+bool drive_get_dpt(void);
+bool bootblock_build(void);
+bool bootblock_create(void);
+bool bootblock_remove(void);
+
+// to be provided by program using the core:
+enum bbq {	// questions, see bb_cancel()
+	BBQ_OVERWRITE,	// disc already has boot block
+	BBQ_DATALOSS,	// boot block is allocated, so it belongs to a file
+	BBQ_REMOVE	// boot block found, remove it?
+};
+void __fastcall__ bb_print(const char *msg);	// show progress message
+void __fastcall__ bb_error(const char *msg);	// show error message (without "Error:")
+bool __fastcall__ bb_cancel(enum bbq question);	// ask user, return true on cancel
+
+#endif
@@ -0,0 +1,472 @@
+// host tool to check, create and remove boot blocks in d64 images, using
+// the same boot block core as macbootmake (see bbcore.h).
+//
+// usage:
+//	bbtool [-f] IMAGE check		show whether image has a boot block
+//	bbtool [-f] IMAGE remove	deactivate boot block
+//	bbtool [-f] IMAGE basic NAME	boot block runs basic program NAME
+//	bbtool [-f] IMAGE mc NAME [BANK]	boot block runs machine code NAME
+//	bbtool IMAGE place [LOADER]	move file loaded by boot block next to
+//					the directory, with sector interleave
+//					for LOADER (kernal, burst, fast or a
+//					number, default depends on boot block)
+// without -f, existing boot blocks and allocated T1S0 are left alone.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bbcore.h"
+#include "d64.h"
+
+static bool	force;
+static bool	check_only;
+static bool	cancelled;	// core stopped because of bb_cancel(), not an error
+
+// output and questions for boot block core (see bbcore.h)
+void bb_print(const char *msg)
+{
+	fputs(msg, stdout);
+}
+
+void bb_error(const char *msg)
+{
+	printf("  Error: %s.\n", msg);
+}
+
+bool bb_cancel(enum bbq question)
+{
+	switch (question) {
+	case BBQ_OVERWRITE:
+		cancelled = !force;
+		printf("  Disc already has a valid boot block%s\n", force ? ", overwriting it." : " (use -f to overwrite).");
+		return !force;
+	case BBQ_DATALOSS:
+		cancelled = !force;
+		printf("  Boot block is allocated, so it may belong to a file%s\n", force ? ", overwriting it." : " (use -f to overwrite).");
+		return !force;
+	case BBQ_REMOVE:
+		cancelled = check_only;
+		return check_only;
+	}
+	return 1;	// cancel
+}
+
+static int usage(void)
+{
+	fprintf(stderr,
+		"usage: bbtool [-f] IMAGE check\n"
+		"       bbtool [-f] IMAGE remove\n"
+		"       bbtool [-f] IMAGE basic NAME\n"
+		"       bbtool [-f] IMAGE mc NAME [BANK]\n"
+		"       bbtool IMAGE place [kernal|burst|fast|INTERLEAVE]\n");
+	return EXIT_FAILURE;
+}
+
+// file placement:
+// the file the boot block loads is rewritten so that its blocks are close to
+// the directory (less head movement after the drive looked up the name) and
+// follow each other with an interleave that suits the loader (so the next
+// block arrives under the head just when the loader wants it).
+#define INTERLEAVE_KERNAL	10	// what 1541 dos uses, slow serial bus
+#define INTERLEAVE_BURST	6	// fast serial bus (1571 in c128 mode)
+#define INTERLEAVE_FAST		7	// 2-bit loader: ~6 sectors pass while sending a block
+#define FILE_BLOCKS_MAX		683	// whole 35-track disc
+#define BLOCK_DATA		254
+// boot sector layout (see bootblock_build() in bbcore.c)
+#define BS_PRELOAD_ADDR		3
+#define BS_PRELOAD_COUNT	6
+#define BS_MESSAGE		7
+// loader parameter block in first preloaded sector (see loader.inc)
+#define LDR_DEVICE		3
+#define LDR_NAMELEN		6
+#define LDR_NAME		7
+#define LDR_TRACK		38
+#define LDR_SECTOR		39
+// directory entry, offsets in sector
+#define DIRENTRY_TYPE		2
+#define DIRENTRY_TRACK		3
+#define DIRENTRY_SECTOR		4
+#define DIRENTRY_NAME		5
+#define FILETYPE_MASK		0x87	// ignore "locked" and "replace" bits
+#define FILETYPE_CLOSEDPRG	0x82
+
+static uint8_t	place_name[16];	// padded with shift-space, petscii
+static uint8_t	place_data[FILE_BLOCKS_MAX * BLOCK_DATA];
+static int	place_blocks;
+static uint8_t	place_last;	// number of bytes in last block
+
+// find byte sequence in memory, returns pointer to it or NULL
+static uint8_t *find_seq(uint8_t *mem, int size, const void *seq, int len)
+{
+	int	ii;
+
+	for (ii = 0; ii + len <= size; ++ii) {
+		if (memcmp(mem + ii, seq, len) == 0)
+			return mem + ii;
+	}
+	return NULL;
+}
+
+// print petscii name as ascii
+static void print_name(void)
+{
+	int	ii;
+	uint8_t	cc;
+
+	putchar('"');
+	for (ii = 0; ii < 16 && place_name[ii] != 0xa0; ++ii) {
+		cc = place_name[ii];
+		if (cc >= 0x41 && cc <= 0x5a)
+			cc += 0x20;
+		else if (cc >= 0xc1 && cc <= 0xda)
+			cc -= 0x80;
+		putchar((cc >= 0x20 && cc < 0x7f) ? cc : '?');
+	}
+	putchar('"');
+}
+
+// check whether boot block preloads a loader image (see bootcode.s):
+// the boot code ends in "jmp LOADER_ADDR", an embedded program that merely
+// happens to live at LOADER_ADDR is started through JMPFAR instead
+static bool has_loader(void)
+{
+	uint8_t	*bs	= d64_block(1, 0);
+	int	ii;
+
+	if (!bs[BS_PRELOAD_COUNT] || bs[BS_PRELOAD_ADDR] + 256 * bs[BS_PRELOAD_ADDR + 1] != LOADER_ADDR)
+		return false;
+	// skip message, then boot file name
+	for (ii = BS_MESSAGE; ii < 256 && bs[ii]; ++ii)
+		;
+	for (++ii; ii < 256 && bs[ii]; ++ii)
+		;
+	++ii;
+	return ii < 256 && find_seq(bs + ii, 256 - ii, "\x4c\x00\x13", 3);	// jmp LOADER_ADDR
+}
+
+// find out which file the boot block loads and with which kind of loader.
+// returns interleave for that loader, or 0 on error
+static int place_find_name(void)
+{
+	uint8_t	*bs	= d64_block(1, 0),
+		*ldr	= d64_block(1, 1);
+	int	ii,
+		len;
+
+	if (memcmp(bs, "\x43\x42\x4d", 3) != 0) {
+		fprintf(stderr, "Error: Image has no boot block.\n");
+		return 0;
+	}
+	// skip message, then boot file name
+	for (ii = BS_MESSAGE; ii < 256 && bs[ii]; ++ii)
+		;
+	for (++ii; ii < 256 && bs[ii]; ++ii)
+		;
+	// kernal LOAD: "lda #len, ldx #<name, ldy #>name, jsr SETNAM"
+	for (++ii; ii + 14 <= 256; ++ii) {
+		if (bs[ii] != 0xa9 || bs[ii + 2] != 0xa2 || memcmp(bs + ii + 4, "\xa0\x0b\x20\xbd\xff", 5) != 0)
+			continue;
+		// next is "lda #0", then "ldx $ba" for boot device
+		if (memcmp(bs + ii + 11, "\xa6\xba", 2) != 0) {
+			fprintf(stderr, "Error: Boot block loads from another device.\n");
+			return 0;
+		}
+		len = bs[ii + 1];
+		if (len > 16 || bs[ii + 3] + len > 256) {
+			fprintf(stderr, "Error: Bad file name in boot block.\n");
+			return 0;
+		}
+		memset(place_name, 0xa0, 16);
+		memcpy(place_name, bs + bs[ii + 3], len);
+		return INTERLEAVE_KERNAL;
+	}
+	// loader image in preloaded sectors (see bootcode.s)
+	if (!has_loader()) {
+		fprintf(stderr, "Error: Boot block does not load a file.\n");
+		return 0;
+	}
+	if (ldr[LDR_DEVICE]) {
+		fprintf(stderr, "Error: Boot block loads from another device.\n");
+		return 0;
+	}
+	len = ldr[LDR_NAMELEN];
+	if (len > 16) {
+		fprintf(stderr, "Error: Bad file name in boot block.\n");
+		return 0;
+	}
+	memset(place_name, 0xa0, 16);
+	memcpy(place_name, ldr + LDR_NAME, len);
+	// only the 2-bit loader uploads drive code,
+	// and only the burst loaders send "u0" + $1f
+	for (ii = 1; ii <= bs[BS_PRELOAD_COUNT]; ++ii) {
+		if (find_seq(d64_block(1, ii), 256, "\x4d\x2d\x57", 3))	// "m-w"
+			return INTERLEAVE_FAST;
+	}
+	for (ii = 1; ii <= bs[BS_PRELOAD_COUNT]; ++ii) {
+		if (find_seq(d64_block(1, ii), 256, "\x55\x30\x1f", 3))	// "u0" + $1f
+			return INTERLEAVE_BURST;
+	}
+	return INTERLEAVE_KERNAL;
+}
+
+// find directory entry of file, returns pointer to it or NULL
+static uint8_t *place_find_entry(void)
+{
+	uint8_t	*block;
+	int	track	= D64_DIR_TRACK,
+		sector	= 1,
+		count	= 0,
+		ii;
+
+	while (track && count++ < 19) {
+		block = d64_block(track, sector);
+		if (block == NULL)
+			break;
+		for (ii = 0; ii < 256; ii += 32) {
+			if ((block[ii + DIRENTRY_TYPE] & FILETYPE_MASK) == FILETYPE_CLOSEDPRG
+			&& memcmp(block + ii + DIRENTRY_NAME, place_name, 16) == 0)
+				return block + ii;
+		}
+		track = block[0];
+		sector = block[1];
+	}
+	fprintf(stderr, "Error: File not found in directory.\n");
+	return NULL;
+}
+
+// read file, free its blocks and show where they were
+// returns true on error
+static bool place_read(uint8_t track, uint8_t sector)
+{
+	uint8_t	*block,
+		previous	= 0;	// track of previous block
+	int	changes	= 0;
+
+	place_blocks = 0;
+	printf("  Old chain:");
+	while (track) {
+		block = d64_block(track, sector);
+		if (block == NULL || place_blocks == FILE_BLOCKS_MAX) {
+			fprintf(stderr, "\nError: Bad sector chain.\n");
+			return 1;
+		}
+		if (track != previous) {
+			printf(" %u/%u", track, sector);
+			if (previous)
+				++changes;
+			previous = track;
+		}
+		place_last = block[0] ? BLOCK_DATA : block[1] - 1;
+		memcpy(place_data + place_blocks * BLOCK_DATA, block + 2, place_last);
+		++place_blocks;
+		d64_free(track, sector);
+		track = block[0];
+		sector = block[1];
+	}
+	printf(" (%d blocks, %d track changes)\n", place_blocks, changes);
+	return 0;
+}
+
+// find free block for next part of file: on current track if possible (at
+// "interleave" sectors from the last one), else on the next free track,
+// going away from the directory (like dos does)
+static bool place_next(uint8_t *track, uint8_t *sector, int interleave, int *direction)
+{
+	int	tt,
+		ss,
+		ii,
+		count;
+
+	tt = *track;
+	ss = *sector + interleave;
+	for (;;) {
+		count = d64_sectors(tt);
+		for (ii = 0; ii < count; ++ii) {
+			if (d64_is_free(tt, (ss + ii) % count)) {
+				*track = tt;
+				*sector = (ss + ii) % count;
+				d64_allocate(*track, *sector);
+				return 0;
+			}
+		}
+		// track is full, so go on with the next one
+		tt += *direction;
+		if (tt < 1 || tt > D64_BAM_TRACKS) {
+			if (*direction == 1)
+				return 1;	// disc full (both sides were tried)
+			*direction = 1;
+			tt = D64_DIR_TRACK + 1;
+		}
+		ss = 0;
+	}
+}
+
+// write file to new blocks, fix up directory entry and loader parameters
+// returns true on error
+static bool place_write(uint8_t *entry, int interleave)
+{
+	static uint8_t	tracks[FILE_BLOCKS_MAX],
+			sectors[FILE_BLOCKS_MAX];
+	uint8_t		*block,
+			*ldr	= d64_block(1, 1),
+			track,
+			sector,
+			old_track	= entry[DIRENTRY_TRACK],
+			old_sector	= entry[DIRENTRY_SECTOR],
+			old_ref[18];
+	int		direction	= -1,
+			changes	= 0,
+			ii;
+
+	// start right next to directory, then go outwards
+	track = D64_DIR_TRACK - 1;
+	sector = d64_sectors(track) - interleave;	// so search starts at sector 0
+	for (ii = 0; ii < place_blocks; ++ii) {
+		if (place_next(&track, &sector, interleave, &direction)) {
+			fprintf(stderr, "Error: Disc full.\n");
+			return 1;
+		}
+		tracks[ii] = track;
+		sectors[ii] = sector;
+	}
+	printf("  New chain:");
+	for (ii = 0; ii < place_blocks; ++ii) {
+		block = d64_block(tracks[ii], sectors[ii]);
+		memset(block, 0, 256);
+		if (ii + 1 < place_blocks) {
+			block[0] = tracks[ii + 1];
+			block[1] = sectors[ii + 1];
+			memcpy(block + 2, place_data + ii * BLOCK_DATA, BLOCK_DATA);
+		} else {
+			block[0] = 0;
+			block[1] = place_last + 1;
+			memcpy(block + 2, place_data + ii * BLOCK_DATA, place_last);
+		}
+		if (ii == 0 || tracks[ii] != tracks[ii - 1])
+			printf(" %u/%u", tracks[ii], sectors[ii]);
+		if (ii && tracks[ii] != tracks[ii - 1])
+			++changes;
+	}
+	printf(" (interleave %d, %d track changes)\n", interleave, changes);
+	entry[DIRENTRY_TRACK] = tracks[0];
+	entry[DIRENTRY_SECTOR] = sectors[0];
+	// loaders started with track/sector (see LDR_TRACK in macbootmake.c)
+	if (has_loader() && ldr[LDR_TRACK] == old_track && ldr[LDR_SECTOR] == old_sector) {
+		ldr[LDR_TRACK] = tracks[0];
+		ldr[LDR_SECTOR] = sectors[0];
+	}
+	// boot menu tables hold name, track and sector (see menu.inc)
+	memcpy(old_ref, place_name, 16);
+	old_ref[16] = old_track;
+	old_ref[17] = old_sector;
+	for (ii = 1; ii <= d64_block(1, 0)[BS_PRELOAD_COUNT]; ++ii) {
+		block = d64_block(1, ii);
+		while ((block = find_seq(block, d64_block(1, ii) + 256 - block, old_ref, 18))) {
+			block[16] = tracks[0];
+			block[17] = sectors[0];
+		}
+	}
+	return 0;
+}
+
+// move file loaded by boot block
+// returns true on error
+static bool place(const char *loader)
+{
+	int	interleave;
+	uint8_t	*entry;
+
+	interleave = place_find_name();
+	if (interleave == 0)
+		return 1;
+	if (loader) {
+		if (strcmp(loader, "kernal") == 0)
+			interleave = INTERLEAVE_KERNAL;
+		else if (strcmp(loader, "burst") == 0)
+			interleave = INTERLEAVE_BURST;
+		else if (strcmp(loader, "fast") == 0)
+			interleave = INTERLEAVE_FAST;
+		else
+			interleave = atoi(loader);
+		if (interleave < 1 || interleave > 20) {
+			fprintf(stderr, "Error: Bad interleave.\n");
+			return 1;
+		}
+	}
+	entry = place_find_entry();
+	if (entry == NULL)
+		return 1;
+	printf("Placing ");
+	print_name();
+	printf(":\n");
+	return place_read(entry[DIRENTRY_TRACK], entry[DIRENTRY_SECTOR])
+		|| place_write(entry, interleave);
+}
+
+int main(int argc, char *argv[])
+{
+	const char	*image,
+			*cmd;
+	bool		failed;
+
+	++argv;
+	--argc;
+	if (argc && strcmp(argv[0], "-f") == 0) {
+		force = 1;
+		++argv;
+		--argc;
+	}
+	if (argc < 2)
+		return usage();
+
+	image = argv[0];
+	cmd = argv[1];
+	if (strcmp(cmd, "place") == 0 && argc <= 3) {
+		if (d64_load(image) || place(argc == 3 ? argv[2] : NULL))
+			return EXIT_FAILURE;
+		return d64_save(image) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	conf.alternative_device = ALTDEVICE_NONE;
+	conf.chosen_bank = 15;
+	if (strcmp(cmd, "check") == 0 && argc == 2) {
+		check_only = 1;
+	} else if (strcmp(cmd, "remove") == 0 && argc == 2) {
+		check_only = 0;
+	} else if (strcmp(cmd, "basic") == 0 && argc == 3) {
+		conf.action = ACTION_RUNBASIC;
+	} else if (strcmp(cmd, "mc") == 0 && (argc == 3 || argc == 4)) {
+		conf.action = ACTION_BOOTMC;
+		if (argc == 4)
+			conf.chosen_bank = atoi(argv[3]) & 15;
+	} else {
+		return usage();
+	}
+	if (argc >= 3) {
+		if (strlen(argv[2]) >= FILENAME_BUF_LEN) {
+			fprintf(stderr, "Error: File name is too long.\n");
+			return EXIT_FAILURE;
+		}
+		strcpy(filename_buf, argv[2]);
+	}
+	if (d64_load(image))
+		return EXIT_FAILURE;
+
+	transport = &d64_transport;
+	if (transport->open())
+		return EXIT_FAILURE;
+
+	failed = drive_get_dpt();
+	if (!failed) {
+		if (argc >= 3)
+			failed = bootblock_create();
+		else
+			failed = bootblock_remove();
+	}
+	transport->close();
+	if (failed)
+		return cancelled ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (check_only)
+		return EXIT_SUCCESS;
+
+	return d64_save(image) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,201 @@
+; MacBootMake boot loaders
+;
+; each image gets preloaded from track 1 to LOADER_ADDR by the kernal's boot
+; routine and is then called from the boot code in T1S0.
+; macbootmake copies an image to its preload buffer and fills in the
+; parameter block before writing it to disc.
+
+		.export	_burst_image, _burst_image_end
+		.export	_fast1541_image, _fast1541_image_end
+		.export	_go64burst_image, _go64burst_image_end
+		.export	_go64fast_image, _go64fast_image_end
+		.export	_menu1541_image, _menu1541_image_end
+		.export	_menuchain_image, _menuchain_image_end
+		.export	_unpack_image, _unpack_image_end
+		.export	_menu_offset
+
+LOADER_ADDR	= $1300		; must match macbootmake.c
+UNPACK_END	= $1800		; unpack image must end below this, must match pack.c
+
+; flags in parameter block
+LDRF_BASIC	= $80		; program is basic (set at runtime)
+LDRF_RAM1	= $40		; chosen bank uses RAM1, so store via kernal
+LDRF_TIMING	= $20		; record start of program (not for c64 programs)
+
+; boot timing record, see TIMING_ADDR in bbcore.h
+TIMING_ADDR	= $0bf7
+TIMING_START	= TIMING_ADDR + 5	; cia 2 timers when starting program
+
+; kernal
+SETBNK		= $ff68
+JMPFAR		= $ff71
+STASH		= $ff77
+SETLFS		= $ffba
+SETNAM		= $ffbd
+OPEN		= $ffc0
+CLOSE		= $ffc3
+CHKIN		= $ffc6
+CKOUT		= $ffc9
+CLRCH		= $ffcc
+GETIN		= $ffe4
+BASIN		= $ffcf
+BSOUT		= $ffd2
+LOAD		= $ffd5
+READST		= $ffb7
+STAVEC		= $02b9		; zero page address for STASH
+SERIAL		= $0a1c		; bit 6 is set if device answered fast serial handshake
+; basic
+BASIC_START	= $1c01
+BASIC_TEXTTOP	= $1210		; end of basic text
+BASIC_LINKPRG	= $4f4f		; re-link program lines
+BASIC_EXECUTE	= $afa5		; execute text at X/Y + 1
+; zero page
+ZP_FARBANK	= $02		; JMPFAR parameters: bank,
+ZP_FARPC	= $03		;	address (high byte first!),
+ZP_FARSR	= $05		;	status register
+ZP_SAL		= $ac		; LOAD leaves start address of loaded data here
+ZP_FA		= $ba		; current device (the boot device, at boot time)
+dst		= $fb		; write pointer (two bytes)
+rbyte		= $fd		; byte being received
+src		= $fd		; copy pointer for go64 and decrunch (two bytes)
+match		= $24		; read pointer for decrunch (two bytes, basic temp)
+; i/o
+VIC_CR1		= $d011		; bit 4 enables display, bit 7 is raster bit 8
+VIC_CLKRATE	= $d030		; bit 0 selects 2 MHz
+CIA1_SDR	= $dc0c		; serial data register (fast serial)
+CIA1_ICR	= $dc0d
+CIA1_CRA	= $dc0e
+CIA2_PRA	= $dd00		; bit 4 is CLK out, bit 6 is CLK in, bit 7 is DATA in
+CIA2_TIMER	= $dd04		; timer a and b, used for boot timing
+CIA2_CRA	= $dd0e
+MMU_MCR		= $d505		; bit 3 is fast serial direction
+MMU_RCR		= $d506		; common RAM
+MMU_CR		= $ff00		; configuration register
+CR_RAM0		= $3f		; configuration with RAM0 only
+
+LFN_CMD		= 15		; logical file number for command channel
+LFN_FILE	= 2		; logical file number for reading a file (see load_file)
+
+		.rodata
+
+; burst loader for 1571/1581, see burst.inc
+_burst_image:
+		.org	LOADER_ADDR
+.proc	burst
+		.include	"loader.inc"
+
+entry:		jsr	init
+		jmp	burstload
+
+		.include	"burst.inc"
+image_end:
+.endproc
+		.reloc
+_burst_image_end:
+
+; 2-bit loader for 1541 (and 1571 in 1541 mode), see fast1541.inc
+_fast1541_image:
+		.org	LOADER_ADDR
+.proc	fast1541
+		.include	"loader.inc"
+
+entry:		jsr	init
+		jmp	fastload
+
+		.include	"cbmdos.inc"
+		.include	"fast1541.inc"	; must be last, drive code changes .org
+image_end:
+.endproc
+		.reloc
+_fast1541_image_end:
+
+; c64 mode loaders: load to bank 1 in c128 mode, then go to c64 mode.
+; go64burst uses burst mode, go64fast uses the 2-bit loader.
+_go64burst_image:
+		.org	LOADER_ADDR
+.proc	go64burst
+C64_PRG		= 1
+		.include	"loader.inc"
+
+entry:		jsr	init
+		jmp	burstload
+
+		.include	"go64.inc"
+		.include	"burst.inc"
+image_end:
+.endproc
+		.reloc
+_go64burst_image_end:
+
+_go64fast_image:
+		.org	LOADER_ADDR
+.proc	go64fast
+C64_PRG		= 1
+		.include	"loader.inc"
+
+entry:		jsr	init
+		jmp	fastload
+
+		.include	"go64.inc"
+		.include	"cbmdos.inc"
+		.include	"fast1541.inc"	; must be last, drive code changes .org
+image_end:
+.endproc
+		.reloc
+_go64fast_image_end:
+
+; boot menus: list files, then load the chosen one by name or track/sector.
+; menu1541 uses the 2-bit loader, menuchain reads the blocks via "u1".
+_menu1541_image:
+		.org	LOADER_ADDR
+.proc	menu1541
+		.include	"loader.inc"
+		.include	"menu.inc"
+
+entry:		jsr	init
+		jsr	menu
+		jmp	fastload
+
+		.include	"cbmdos.inc"
+		.include	"fast1541.inc"	; must be last, drive code changes .org
+image_end:
+.endproc
+		.reloc
+_menu1541_image_end:
+
+_menuchain_image:
+		.org	LOADER_ADDR
+.proc	menuchain
+		.include	"loader.inc"
+		.include	"menu.inc"
+
+entry:		jsr	init
+		jsr	menu
+		jmp	chainload
+
+		.include	"chain.inc"
+image_end:
+.endproc
+		.reloc
+_menuchain_image_end:
+
+; packed programs: kernal LOAD, then decrunch in place, see unpack.inc
+_unpack_image:
+		.org	LOADER_ADDR
+.proc	unpack
+		.include	"loader.inc"
+
+entry:		jsr	init
+		jmp	unpackload
+
+		.include	"unpack.inc"
+		.include	"decrunch.inc"
+image_end:
+		.assert	image_end <= UNPACK_END, error, "unpack image too large, see pack.c"
+.endproc
+		.reloc
+_unpack_image_end:
+
+; offset of menu_count in both menu images, for macbootmake
+_menu_offset	= menu1541::menu_count - LOADER_ADDR
+		.assert	menuchain::menu_count = menu1541::menu_count, error, "menu table offsets differ"
@@ -0,0 +1,291 @@
+// disc image transport, see d64.h
+#include <stdio.h>
+#include <string.h>
+#include "bbcore.h"
+#include "d64.h"
+
+#define D64_SIZE_35	174848	// 683 blocks
+#define D64_SIZE_40	196608	// 768 blocks
+
+static uint8_t	image[D64_SIZE_40];
+uint8_t		d64_tracks;
+// emulated drive state:
+static uint8_t	drive_buf[256];	// buffer of buffer channel
+static uint8_t	drive_pos;	// buffer pointer
+static bool	drive_pos_end;	// buffer pointer went past last byte
+static char	drive_status[40]	= "00, ok,00,00";
+
+uint8_t d64_sectors(uint8_t track)
+{
+	if (track == 0 || track > d64_tracks)
+		return 0;
+	if (track <= 17)
+		return 21;
+	if (track <= 24)
+		return 19;
+	if (track <= 30)
+		return 18;
+	return 17;
+}
+
+uint8_t *d64_block(uint8_t track, uint8_t sector)
+{
+	static unsigned int	tt;
+	static long		offset;
+
+	if (sector >= d64_sectors(track))
+		return NULL;
+	offset = sector;
+	for (tt = 1; tt < track; ++tt)
+		offset += d64_sectors(tt);
+	return image + offset * 256;
+}
+
+// return pointer to bam entry of track (free count, then three bitmap bytes)
+static uint8_t *bam_entry(uint8_t track)
+{
+	if (track == 0 || track > D64_BAM_TRACKS)
+		return NULL;
+	return d64_block(D64_DIR_TRACK, 0) + D64_BAM_OFFSET + 4 * (track - 1);
+}
+
+bool d64_is_free(uint8_t track, uint8_t sector)
+{
+	uint8_t	*entry	= bam_entry(track);
+
+	if (entry == NULL || sector >= d64_sectors(track))
+		return 0;
+	return (entry[1 + (sector >> 3)] >> (sector & 7)) & 1;
+}
+
+bool d64_allocate(uint8_t track, uint8_t sector)
+{
+	uint8_t	*entry	= bam_entry(track);
+
+	if (!d64_is_free(track, sector))
+		return 1;	// fail
+	entry[1 + (sector >> 3)] &= ~(1 << (sector & 7));
+	--entry[0];
+	return 0;	// ok
+}
+
+void d64_free(uint8_t track, uint8_t sector)
+{
+	uint8_t	*entry	= bam_entry(track);
+
+	if (entry == NULL || sector >= d64_sectors(track) || d64_is_free(track, sector))
+		return;
+	entry[1 + (sector >> 3)] |= 1 << (sector & 7);
+	++entry[0];
+}
+
+bool d64_load(const char *name)
+{
+	FILE	*fd;
+	size_t	size;
+
+	fd = fopen(name, "rb");
+	if (fd == NULL) {
+		fprintf(stderr, "Error: Cannot open %s.\n", name);
+		return 1;	// fail
+	}
+	size = fread(image, 1, sizeof(image), fd);
+	fclose(fd);
+	if (size == D64_SIZE_35) {
+		d64_tracks = 35;
+	} else if (size == D64_SIZE_40) {
+		d64_tracks = 40;
+	} else {
+		fprintf(stderr, "Error: %s is not a d64 image (without error info).\n", name);
+		return 1;	// fail
+	}
+	return 0;	// ok
+}
+
+bool d64_save(const char *name)
+{
+	FILE	*fd;
+	size_t	size	= (d64_tracks == 40) ? D64_SIZE_40 : D64_SIZE_35;
+
+	fd = fopen(name, "wb");
+	if (fd == NULL || fwrite(image, 1, size, fd) != size) {
+		fprintf(stderr, "Error: Cannot write %s.\n", name);
+		if (fd)
+			fclose(fd);
+		return 1;	// fail
+	}
+	return fclose(fd) != 0;
+}
+
+// transport functions:
+
+static void set_status(const char *msg, uint8_t track, uint8_t sector)
+{
+	snprintf(drive_status, sizeof(drive_status), "%s,%02u,%02u", msg, track, sector);
+}
+
+static bool d64_open(void)
+{
+	drive_pos = 0;
+	drive_pos_end = 0;
+	set_status("00, ok", 0, 0);
+	return 0;	// ok
+}
+
+static void d64_close(void)
+{
+}
+
+static int d64_format(void)
+{
+	return d64_block(D64_DIR_TRACK, 0)[2];	// dos version, like raw "$" does
+}
+
+// commands arrive in petscii, so make letters lower case ascii
+static char ascii(uint8_t cc)
+{
+	if (cc >= 0x41 && cc <= 0x5a)
+		return cc + 0x20;
+	if (cc >= 0xc1 && cc <= 0xda)
+		return cc - 0x60;
+	return cc;
+}
+
+// read up to "max" decimal arguments, return how many were found
+static int get_args(const char *cmd, uint8_t len, unsigned int *args, int max)
+{
+	static uint8_t	ii;
+	int		found	= 0;
+	bool		in_number	= 0;
+
+	for (ii = 0; ii < len; ++ii) {
+		if (cmd[ii] >= '0' && cmd[ii] <= '9') {
+			if (!in_number) {
+				if (found == max)
+					return -1;	// too many
+				args[found++] = 0;
+				in_number = 1;
+			}
+			args[found - 1] = args[found - 1] * 10 + cmd[ii] - '0';
+		} else {
+			in_number = 0;
+		}
+	}
+	return found;
+}
+
+// execute drive command (only the ones the core uses)
+static bool d64_command(const char *cmd, uint8_t len)
+{
+	static char		word[4];
+	static uint8_t		ii,
+				skip;
+	static unsigned int	args[4];
+	uint8_t			*block;
+
+	memset(word, 0, sizeof(word));
+	for (ii = 0; ii < len && ii < 3 && cmd[ii] != ' '; ++ii)
+		word[ii] = ascii(cmd[ii]);
+	skip = ii;
+	set_status("00, ok", 0, 0);
+	if (word[0] == 'i')
+		return 0;	// ok, nothing to initialise
+
+	if (strcmp(word, "b-p") == 0) {
+		if (get_args(cmd + skip, len - skip, args, 2) != 2 || args[1] > 255) {
+			set_status("30,syntax error", 0, 0);
+			return 0;
+		}
+		drive_pos = args[1];
+		drive_pos_end = 0;
+		return 0;
+	}
+	if (strcmp(word, "u1") == 0 || strcmp(word, "u2") == 0 || strcmp(word, "ua") == 0 || strcmp(word, "ub") == 0) {
+		// channel, drive, track, sector
+		if (get_args(cmd + skip, len - skip, args, 4) != 4) {
+			set_status("30,syntax error", 0, 0);
+			return 0;
+		}
+		block = (args[2] > 255 || args[3] > 255) ? NULL : d64_block(args[2], args[3]);
+		if (block == NULL) {
+			set_status("66,illegal track or sector", args[2], args[3]);
+			return 0;
+		}
+		if (word[1] == '1' || word[1] == 'a')
+			memcpy(drive_buf, block, 256);
+		else
+			memcpy(block, drive_buf, 256);
+		drive_pos = 0;
+		drive_pos_end = 0;
+		return 0;
+	}
+	if (strcmp(word, "b-a") == 0 || strcmp(word, "b-f") == 0) {
+		// drive, track, sector
+		if (get_args(cmd + skip, len - skip, args, 3) != 3) {
+			set_status("30,syntax error", 0, 0);
+			return 0;
+		}
+		if (args[1] > D64_BAM_TRACKS || args[2] > 255 || d64_block(args[1], args[2]) == NULL) {
+			set_status("66,illegal track or sector", args[1], args[2]);
+			return 0;
+		}
+		if (word[2] == 'f')
+			d64_free(args[1], args[2]);
+		else if (d64_allocate(args[1], args[2]))
+			set_status("65,no block", args[1], args[2]);
+		return 0;
+	}
+	set_status("31,syntax error", 0, 0);
+	return 0;	// sending worked, error is in status
+}
+
+static bool d64_status(void)
+{
+	bool	error	= drive_status[0] != '0';
+
+	bb_print("  Status: \"");
+	bb_print(drive_status);
+	bb_print("\"\n");
+	set_status("00, ok", 0, 0);
+	return error;
+}
+
+static bool d64_read(void *data, uint16_t len)
+{
+	static uint16_t	ii;
+
+	for (ii = 0; ii < len; ++ii) {
+		if (drive_pos_end) {
+			bb_error("Unexpected EOF");
+			return 1;	// fail
+		}
+		((uint8_t *) data)[ii] = drive_buf[drive_pos++];
+		drive_pos_end = drive_pos == 0;
+	}
+	return 0;	// ok
+}
+
+static bool d64_write(const void *data, uint16_t len)
+{
+	static uint16_t	ii;
+
+	for (ii = 0; ii < len; ++ii) {
+		if (drive_pos_end) {
+			bb_error("Could not write all data");
+			return 1;	// fail
+		}
+		drive_buf[drive_pos++] = ((const uint8_t *) data)[ii];
+		drive_pos_end = drive_pos == 0;
+	}
+	return 0;	// ok
+}
+
+const struct transport	d64_transport	= {
+	d64_open,
+	d64_close,
+	d64_format,
+	d64_command,
+	d64_status,
+	d64_read,
+	d64_write
+};
@@ -0,0 +1,27 @@
+// disc image transport for the boot block core (see transport.h), for host
+// tools. emulates the drive commands the core uses on a .d64 image in memory.
+#ifndef d64_H
+#define d64_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "transport.h"
+
+#define D64_DIR_TRACK	18
+#define D64_BAM_OFFSET	4	// bam entries start here in 18/0, four bytes per track
+#define D64_BAM_TRACKS	35	// bam of 40-track images differs between dos versions
+
+extern const struct transport	d64_transport;
+extern uint8_t			d64_tracks;	// 35 or 40
+
+// these return true on error (after printing a message)
+bool d64_load(const char *name);
+bool d64_save(const char *name);
+// direct access for host tools:
+uint8_t d64_sectors(uint8_t track);	// number of sectors, 0 for invalid track
+uint8_t *d64_block(uint8_t track, uint8_t sector);	// NULL for invalid block
+bool d64_is_free(uint8_t track, uint8_t sector);
+bool d64_allocate(uint8_t track, uint8_t sector);	// true if not free
+void d64_free(uint8_t track, uint8_t sector);
+
+#endif
@@ -1,130 +1,94 @@
 // converted from basic7.
 // source was macbootmake, version 8 from 2017-02-06
 //
-#define VERSION	"11"
-#define DATE	"27 May"
-#define YEAR	"2021"
-
 #include <cbm.h>
 #include <errno.h>	// only for _oserror
 #include <peekpoke.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include "bbcore.h"
 
 // limits for device address:
 #define DEVICE_MIN	4
 #define DEVICE_MAX	30
 #define ALTDEVICE_MIN	4
-#define ALTDEVICE_MAX	31	// 30 is really the maximum for device numbers, but we use 31 as special value, see below
-#define ALTDEVICE_NONE	31	// this value is used for "use boot device", i.e. "do NOT use an alternative device"
+#define ALTDEVICE_MAX	31	// 30 is really the maximum for device numbers, but we use 31 as special value, see ALTDEVICE_NONE
 // convenience macros
 #define printat(x, y, msg)	do { gotoxy(x, y); print(msg); } while (0)
+#define drawat(x, y, msg)	do { draw_goto(x, y); draw(msg); } while (0)
 #define CHROUT(c)		cbm_k_bsout(c)
 #define ON_VDC			PEEK(215)
 // logical file numbers
 #define LFN_CMD		1	// drive's command channel
 #define	LFN_BUF		2	// block buffer
 #define LFN_RAWDIR	3	// raw directory to determine drive/partition type
+#define LFN_FILE	4	// program file to embed in boot block
+#define LFN_SCAN	5	// command channel of device being checked
 // secondary addresses
 #define SA_CMD		15	// drive's command channel is 15
-#define SA_BUF		2	// could be anything in 2..14 range
 #define SA_RAWDIR	3	// ...as above, but must be different of course
-// needed to put number in string:
-#define STR(x)	#x	// stringize
-#define XSTR(x)	STR(x)	// expand, then stringize
+#define SA_FILE		4	// ...as above
+#define SA_SCAN		14	// ...as above; not 15, because closing that would close all files
 // control codes in strings
 #define COLOR_EMPH	"\x05"	// white
 #define COLOR_STD	"\x9b"	// light gray
 #define REVSON		"\x12"
 #define REVSOFF		"\x92"
 #define HOME		"\x13"
-// control codes (cc65 seems to garble some of them when inside strings, so don't put them there)
-#define c_CONTROL_D	4	// used in menu for "scan for next device"
-#define c_BELL		0x07	// C128 only!
-#define c_LOCK		0x0b	// C128 only! C64 uses 8!
-#define c_UNLOCK	0x0c	// C128 only! C64 uses 9!
-#define c_HOME		0x13
-#define c_CLEAR		0x93
-#define c_LOWERCASE	0x0e
-#define c_UPPERCASE	0x8e
-#define c_ESCAPE	0x1b	// C128 only!
-
-// drive/partition types:
-struct dpt {
-	uint8_t	valid;	// so "unknown" entry forbids action
-	uint8_t	fiddle_with_bam;	// set if allocation/freeing must be done
-	char	*track_and_sector;	// where to find allocation byte
-	char	*byte_offset;		// byte offset in sector (and then use its lsb)
-	char	*name;	// symbolic name to display
-};
-struct dpt	dpt_1541	= {1, 1, "18 0", "5",  "1541/1571"};
-struct dpt	dpt_ieee	= {1, 1, "38 0", "7",  "SFD/8050/8250"};
-struct dpt	dpt_1581	= {1, 1, "40 1", "17", "1581"};
-struct dpt	dpt_cmdnative	= {1, 0, NULL,   NULL, "CMD native"};
-struct dpt	dpt_cmdextnat	= {1, 0, NULL,   NULL, "CMD extended native"};
-struct dpt	dpt_rawsd2iec	= {1, 0, NULL,   NULL, "raw SD2IEC"};
-struct dpt	dpt_unknown	= {0, 0, NULL,   NULL, "unknown"};
-// TODO: add Slave2CBM
 
 // globals:
 uint8_t		chosen_device;
-bool		bootblock_active;	// flag: contents start with "cbm"
-enum as {	// ternary for allocation state:
-	AS_FREE,	// free for files
-	AS_ALLOCATED,	// marked as used in BAM
-	AS_RESERVED	// drive/partition reserves T1S0, so no need to check/alloc/free!
-};
-enum as		allocation_state;	// ternary (free/allocated/dontcarebecausereserved)
-struct dpt	*dpt;	// disk/partition type
-bool		redraw_screen;
+uint8_t		program_device;	// where to load overlays from
+// screen model: what needs to be painted on each screen (vic/vdc)
+#define DIRTY_DEVICE	0x0001	// device address
+#define DIRTY_CONF	0x0002	// config line, shift left by line number
+#define DIRTY_STATIC	0x8000	// clear screen and paint static text
+#define DIRTY_ALL	0xffff
+#define dirty_conf(line)	(DIRTY_CONF << (line))
+#define SCREEN_INDEX	(ON_VDC ? 1 : 0)
+#define mark_dirty(bits)	do { dirty[0] |= (bits); dirty[1] |= (bits); } while (0)
+uint16_t	dirty[2];	// index is SCREEN_INDEX
 bool		quit_program;
-#define FILENAME_BUF_LEN	17	// 16 chars plus terminator
-char		filename_buf[FILENAME_BUF_LEN];
-#define MSG_BUF_LEN	255	// 254 chars plus terminator
-char		message_buffer[MSG_BUF_LEN];
-uint8_t		message_len;
-// user config:
-enum action {	// what to do when booting
-	ACTION_RUNBASIC,
-	ACTION_BOOTMC,
-	// ACTION_GO64LOAD,	// TODO - add action for [enter c64 mode and load":*",8,1:run]
-	ACTIONLIMIT
-};
-enum forcecase {	// which charset to use
-	FORCE_NONE,
-	FORCE_LOWER,
-	FORCE_UPPER,
-	FORCELIMIT
-};
-struct {
-	bool		remove_boot_msg;
-	bool		lock_charset;
-	enum forcecase	force_case;
-	bool		use_local_charset;
-	enum action	action;	// what to do: RUN file or BOOT file or GO64?
-	uint8_t		alternative_device;	// from where to load file?
-	uint8_t		chosen_bank;	// bank in which to run machine code
-} conf;
+// data for preloaded sectors (see bbcore.h):
+static char	preload_buf[PRELOAD_MAX * 256];
+// loader images (see bootcode.s), preloaded to LOADER_ADDR:
+extern const char	burst_image[], burst_image_end[];
+extern const char	fast1541_image[], fast1541_image_end[];
+extern const char	go64burst_image[], go64burst_image_end[];
+extern const char	go64fast_image[], go64fast_image_end[];
+extern const char	menu1541_image[], menu1541_image_end[];
+extern const char	menuchain_image[], menuchain_image_end[];
+extern const char	unpack_image[], unpack_image_end[];
+extern const char	menu_offset[];	// absolute symbol, its "address" is the value
+// offsets in loader's parameter block
+#define LDR_DEVICE	3	// 0 means boot device
+#define LDR_BANK	4
+#define LDR_FLAGS	5
+#define LDR_NAMELEN	6
+#define LDR_NAME	7	// 16 bytes, padded with shift-space
+#define LDR_RUNTEXT	23	// 8 bytes
+#define LDR_MODE	31	// drive mode for c64 mode ("u0>m" + this), 0 means none
+#define LDR_TRACK	38	// start of file, 0 means "search by name"
+#define LDR_SECTOR	39
+#define LDRF_RAM1	0x40	// chosen bank uses RAM1, so loader must store via kernal
+#define LDRF_TIMING	0x20	// record start of program (see TIMING_ADDR)
+// boot menu table in menu images (see menu.inc)
+#define MENU_COUNT	((uint16_t) menu_offset)	// number of entries
+#define MENU_TABLE	(MENU_COUNT + 1)
+#define MENU_MAX	20	// keys a..t
+#define MENU_ENTRY_SIZE	18	// 16 bytes name (padded), track, sector
+// banks 1, 3, 5, 7, 9 and 11 use RAM1 (or RAM3, which is the same on a C128)
+#define bank_uses_ram1(b)	(((b) & 1) && ((b) < 12))
 
 
 // helper functions:
 
-// call something from BASIC 7 ROMs
-// FIXME - this only works as long as this code is located before $4000 ROM itself!
-static void __fastcall__ call_basic_rom(int address)
-{
-	POKE(0x3fd, 0x4c);	// JMP opcode
-	POKEW(0x3fe, address);
-	asm(
-"		lda $ff00	\n"
-"		pha		\n"
-"		lda #0		\n"
-"		sta $ff00	\n"	// full ROMs
-"		jsr $03fd	\n"	// jump to "JMP address" at $3fd, $3fe, $3ff
-"		pla		\n"
-"		sta $ff00	\n"
-	);
-}
+// call something from BASIC 7 ROMs (see romcall.s, code can be above $4000)
+void __fastcall__ call_basic_rom(int address);
+// copy to/from BANK1BSS (see bank1.s, c code must not access it directly)
+void __fastcall__ bank1_fetch(void *to, const void *from, unsigned int size);
+void __fastcall__ bank1_stash(void *to, const void *from, unsigned int size);
 
 // wait a number of vic frames
 static void __fastcall__ vsync_wait(uint8_t frames)
@@ -153,6 +117,29 @@ static void __fastcall__ vsync_wait(uint8_t frames)
 #endif
 }
 
+// speed management, all switching between FAST and SLOW is done here:
+// on the vdc screen, the vic display is not needed, so always go FAST.
+// on the vic screen, stay SLOW while the user interacts, and go FAST with
+// blanked display for sections that do not need the user (key_get() switches
+// back for waiting).
+enum speed {
+	SPEED_SYSTEM,	// SLOW with vic display, as after reset
+	SPEED_INTERACT,	// depends on screen, see above
+	SPEED_BUSY	// FAST, vic display blanked if on vic screen
+};
+static enum speed	speed_mode;
+static void __fastcall__ speed_set(enum speed mode)
+{
+	speed_mode = mode;
+	if (mode == SPEED_SYSTEM || (mode == SPEED_INTERACT && !ON_VDC)) {
+		call_basic_rom(0x77c7);	// go SLOW and enable vic display
+	} else {
+		if (!ON_VDC)
+			POKE(0xd011, PEEK(0xd011) & 0xef);	// blank vic display
+		fast();
+	}
+}
+
 // reset both screens to system's default colors
 static void colors_system(void)
 {
@@ -171,14 +158,14 @@ static void colors_system(void)
 		POKE(0xf1, 13);		// current (vic) color: bright green
 		POKE(0x0a51, 7);	// other (vdc) color: bright cyan (rGBI)
 	}
-	call_basic_rom(0x77c7);	// go SLOW and enable vic display
+	speed_set(SPEED_SYSTEM);
 }
 
 // set colors and machine speed for current screen
 static void colors_own(void)
 {
+	speed_set(SPEED_INTERACT);
 	if (ON_VDC) {
-		fast();
 		asm(
 "			lda #$f0	\n"	// vdc: black background
 "			ldx #26		\n"
@@ -189,7 +176,6 @@ static void colors_own(void)
 		POKE(0xd020, 6);	// vic: blue border
 		POKE(0xd021, 0);	// vic: black background
 		POKE(0xf1, 15);		// current (vic) text color: light gray
-		call_basic_rom(0x77c7);	// go SLOW and enable vic display
 	}
 }
 
@@ -225,6 +211,235 @@ static void __fastcall__ print(const char *msg)
 		CHROUT(*msg++);
 }
 
+// direct screen output, for the menu screen:
+// this writes screen codes and colors straight to vic screen/color ram or
+// vdc memory, which is a lot faster than CHROUT (especially in SLOW mode).
+// it knows about color codes, RVS on/off, CR and ESC-q (erase to end of
+// line), all other control codes are ignored. the cursor is not moved.
+#define VIC_SCREEN	0x0400
+#define VIC_COLORRAM	0xd800
+#define VDC_ADDR	0xd600	// register number (write), status (read)
+#define VDC_DATA	0xd601
+#define VDC_REG_SCREEN	12	// screen start, high byte first
+#define VDC_REG_UPDATE	18	// update address, high byte first
+#define VDC_REG_ATTR	20	// attribute start, high byte first
+#define VDC_REG_COPY	24	// bit 7 selects block copy instead of fill
+#define VDC_REG_COUNT	30	// writing starts block copy/fill
+#define VDC_REG_DATA	31
+#define VDC_REG_SOURCE	32	// block copy source, high byte first
+#define VDC_ALTCHARSET	0x80	// attribute bit for lower case charset
+#define vdc_wait()	while (!(PEEK(VDC_ADDR) & 0x80))
+static uint8_t		screencode[256];	// petscii to screen code, see draw_init()
+static const char	color_codes[16]	= {	// petscii color codes, in vic order
+	0x90, 0x05, 0x1c, 0x9f, 0x9c, 0x1e, 0x1f, 0x9e,
+	0x81, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b
+};
+static const uint8_t	vdc_colors[16]	= {	// vic colors as vdc RGBI values
+	0, 15, 8, 7, 11, 4, 2, 13, 10, 12, 9, 1, 6, 5, 3, 14
+};
+static uint8_t	draw_x,
+		draw_y,
+		draw_color,	// vic color
+		draw_rvs;	// 0x80 if RVS is on
+static uint8_t	line_codes[80],
+		line_colors[80];
+
+// fill petscii-to-screencode table
+static void draw_init(void)
+{
+	static uint8_t	ii;
+
+	ii = 0;
+	do {
+		if (ii < 0x40)
+			screencode[ii] = ii;
+		else if (ii < 0x60)
+			screencode[ii] = ii - 0x40;
+		else if (ii < 0xa0)
+			screencode[ii] = ii - 0x20;	// $80..$9f are control codes anyway
+		else if (ii < 0xc0)
+			screencode[ii] = ii - 0x40;
+		else if (ii < 0xff)
+			screencode[ii] = ii - 0x80;
+		else
+			screencode[ii] = 0x5e;	// pi
+	} while (++ii);
+}
+
+// write vdc register
+static void __fastcall__ vdc_write(uint8_t reg, uint8_t value)
+{
+	POKE(VDC_ADDR, reg);
+	vdc_wait();
+	POKE(VDC_DATA, value);
+}
+
+// read vdc register
+static uint8_t __fastcall__ vdc_read(uint8_t reg)
+{
+	POKE(VDC_ADDR, reg);
+	vdc_wait();
+	return PEEK(VDC_DATA);
+}
+
+// read vdc register pair (high byte first)
+static uint16_t __fastcall__ vdc_read_word(uint8_t reg)
+{
+	return (vdc_read(reg) << 8) | vdc_read(reg + 1);
+}
+
+// write vdc register pair (high byte first)
+static void __fastcall__ vdc_write_word(uint8_t reg, uint16_t value)
+{
+	vdc_write(reg, value >> 8);
+	vdc_write(reg + 1, value);
+}
+
+// copy part of line buffer to screen
+static void __fastcall__ draw_flush(uint8_t start, uint8_t end)
+{
+	static uint16_t	offset;
+	static uint8_t	ii;
+
+	if (start >= end)
+		return;
+
+	if (ON_VDC) {
+		// screen codes
+		offset = draw_y * 80 + start + vdc_read_word(VDC_REG_SCREEN);
+		vdc_write_word(VDC_REG_UPDATE, offset);
+		POKE(VDC_ADDR, VDC_REG_DATA);
+		for (ii = start; ii < end; ++ii) {
+			vdc_wait();
+			POKE(VDC_DATA, line_codes[ii]);
+		}
+		// attributes
+		offset = draw_y * 80 + start + vdc_read_word(VDC_REG_ATTR);
+		vdc_write_word(VDC_REG_UPDATE, offset);
+		POKE(VDC_ADDR, VDC_REG_DATA);
+		for (ii = start; ii < end; ++ii) {
+			vdc_wait();
+			POKE(VDC_DATA, vdc_colors[line_colors[ii]] | VDC_ALTCHARSET);
+		}
+	} else {
+		offset = draw_y * 40 + start;
+		memcpy((char *) VIC_SCREEN + offset, line_codes + start, end - start);
+		memcpy((char *) VIC_COLORRAM + offset, line_colors + start, end - start);
+	}
+}
+
+// set position for draw()
+static void __fastcall__ draw_goto(uint8_t xx, uint8_t yy)
+{
+	draw_x = xx;
+	draw_y = yy;
+}
+
+// output zero-terminated string directly to screen
+static void __fastcall__ draw(const char *msg)
+{
+	static uint8_t	start,
+			width,
+			byte,
+			ii;
+
+	width = ON_VDC ? 80 : 40;
+	start = draw_x;
+	while ((byte = *msg++)) {
+		if (byte == '\n') {
+			draw_flush(start, draw_x);
+			++draw_y;
+			start = draw_x = 0;
+		} else if (byte == c_ESCAPE) {
+			if (*msg == 'q') {
+				++msg;
+				while (draw_x < width) {
+					line_codes[draw_x] = ' ';
+					line_colors[draw_x++] = draw_color;
+				}
+			}
+		} else if (byte == c_RVSON) {
+			draw_rvs = 0x80;
+		} else if (byte == c_RVSOFF) {
+			draw_rvs = 0;
+		} else if ((byte & 0x7f) < 0x20) {
+			// color code or other control code
+			for (ii = 0; ii < 16; ++ii) {
+				if (color_codes[ii] == byte) {
+					draw_color = ii;
+					break;
+				}
+			}
+		} else if (draw_x < width) {
+			line_codes[draw_x] = screencode[byte] | draw_rvs;
+			line_colors[draw_x++] = draw_color;
+		}
+	}
+	draw_flush(start, draw_x);
+}
+
+// screen snapshot, so the menu does not have to be redrawn after side
+// screens and message entry/display.
+// vdc screen and attributes are block copied to unused vdc ram, the vic
+// screen and color ram go to a buffer in bank 1.
+#define SCREEN_SIZE	2000	// vdc screen, or vic screen plus color ram
+#define VDC_SAVE_SCREEN	0x1000	// vdc charsets start at $2000
+#define VDC_SAVE_ATTR	0x1800
+#pragma bss-name (push, "BANK1BSS")
+static char	vic_backup[SCREEN_SIZE];
+#pragma bss-name (pop)
+static uint8_t	saved_screen;	// SCREEN_INDEX + 1, or 0 if there is no snapshot
+// CR at start ensures quote mode is off
+static char	string_init[]	= { 13, 27, 'n', c_LOCK, c_LOWERCASE, c_HOME, c_HOME, c_CLEAR, 0 };
+
+// copy SCREEN_SIZE bytes of vdc ram
+static void __fastcall__ vdc_copy(uint16_t to, uint16_t from)
+{
+	static uint8_t	mode,
+			ii;
+
+	mode = vdc_read(VDC_REG_COPY);
+	vdc_write(VDC_REG_COPY, mode | 0x80);
+	vdc_write_word(VDC_REG_UPDATE, to);
+	vdc_write_word(VDC_REG_SOURCE, from);
+	for (ii = 0; ii < SCREEN_SIZE / 250; ++ii)
+		vdc_write(VDC_REG_COUNT, 250);	// addresses keep counting
+	vdc_write(VDC_REG_COPY, mode & 0x7f);	// kernal expects fill mode
+}
+
+// take snapshot of current screen
+static void screen_save(void)
+{
+	if (ON_VDC) {
+		vdc_copy(VDC_SAVE_SCREEN, vdc_read_word(VDC_REG_SCREEN));
+		vdc_copy(VDC_SAVE_ATTR, vdc_read_word(VDC_REG_ATTR));
+	} else {
+		bank1_stash(vic_backup, (char *) VIC_SCREEN, SCREEN_SIZE / 2);
+		bank1_stash(vic_backup + SCREEN_SIZE / 2, (char *) VIC_COLORRAM, SCREEN_SIZE / 2);
+	}
+	saved_screen = SCREEN_INDEX + 1;
+}
+
+// restore snapshot
+// returns true if there is no snapshot of current screen
+static bool screen_restore(void)
+{
+	if (saved_screen != SCREEN_INDEX + 1)
+		return 1;	// fail
+
+	saved_screen = 0;
+	print(string_init);	// reset editor's window and line links
+	if (ON_VDC) {
+		vdc_copy(vdc_read_word(VDC_REG_SCREEN), VDC_SAVE_SCREEN);
+		vdc_copy(vdc_read_word(VDC_REG_ATTR), VDC_SAVE_ATTR);
+	} else {
+		bank1_fetch((char *) VIC_SCREEN, vic_backup, SCREEN_SIZE / 2);
+		bank1_fetch((char *) VIC_COLORRAM, vic_backup + SCREEN_SIZE / 2, SCREEN_SIZE / 2);
+	}
+	CHROUT(c_HOME);
+	return 0;	// ok
+}
+
 // replacement for INPUT
 // bufsize must include space for terminator
 // returns number of characters _before_ terminator
@@ -276,17 +491,124 @@ static uint8_t key_with_crsr(void)
 	return cbm_k_getin();
 }
 
+// background tasks:
+// a task is a function that does one small step per call and returns true
+// when it has finished. tasks only run while the program waits for keys, so
+// they must not use the logical files of foreground operations.
+// so far only the bus scan runs as a task, reading the drive status and
+// writing blocks are still done in the foreground.
+#define TASKS_MAX	2
+typedef bool (*task_t)(void);
+static task_t	tasks[TASKS_MAX];
+static uint8_t	task_current;
+
+// add task (if it is not running already)
+static void __fastcall__ task_start(task_t task)
+{
+	static uint8_t	ii;
+
+	for (ii = 0; ii < TASKS_MAX; ++ii) {
+		if (tasks[ii] == task)
+			return;
+	}
+	for (ii = 0; ii < TASKS_MAX; ++ii) {
+		if (tasks[ii] == NULL) {
+			tasks[ii] = task;
+			return;
+		}
+	}
+}
+
+// let next task do one step
+static void task_step(void)
+{
+	static uint8_t	ii;
+
+	for (ii = 0; ii < TASKS_MAX; ++ii) {
+		if (++task_current == TASKS_MAX)
+			task_current = 0;
+		if (tasks[task_current]) {
+			if (tasks[task_current]())
+				tasks[task_current] = NULL;	// finished
+			return;
+		}
+	}
+}
+
+// wait for key, letting tasks work meanwhile
+// (user must see screen, so this temporarily leaves SPEED_BUSY)
+static uint8_t key_get(void)
+{
+	static uint8_t	key;
+	static enum speed	old_mode;
+
+	old_mode = speed_mode;
+	speed_set(SPEED_INTERACT);
+	while ((key = cbm_k_getin()) == 0)
+		task_step();
+	speed_set(old_mode);
+	return key;
+}
+
+// call function with SPEED_BUSY, then go back to SPEED_INTERACT
+// (questions in between go through key_get(), the final key_ask() after an
+// error must not be done in here)
+// returns what the function returned
+static bool __fastcall__ busy_call(bool (*fn)(void))
+{
+	static bool	failed;
+
+	speed_set(SPEED_BUSY);
+	failed = fn();
+	speed_set(SPEED_INTERACT);
+	return failed;
+}
+
 // ask for key press
 static void key_ask(void)
 {
 	print(COLOR_EMPH "[any key to go on]" COLOR_STD);
 	keybuf_clear();
-	while (cbm_k_getin() == 0)
-		;
+	key_get();
 }
 
 
+// overlays: rarely used features are not in the main file, they get loaded
+// on demand from the device the program was loaded from (see Makefile).
+// all overlays share the same memory area, so only one can be used at a time.
+#define OVERLAY_NONE		0	// for resident functions
+#define OVERLAY_HELP		1
+#define OVERLAY_DIRECTORY	2
+#define OVERLAY_COMMAND		3
+#define OVERLAY_TIMING		4
+static char	overlay_name[]	= "macbootmake.0";	// last char gets replaced
+static uint8_t	overlay_loaded;	// number of overlay in memory, 0 means none
+// returns true on error
+static bool __fastcall__ overlay_load(uint8_t number)
+{
+	if (number == OVERLAY_NONE || number == overlay_loaded)
+		return 0;
+	overlay_name[sizeof(overlay_name) - 2] = '0' + number;
+	overlay_loaded = OVERLAY_NONE;	// failed load may have trashed area
+	asm(
+"		lda	#0	\n"
+"		tax		\n"
+"		jsr	$ff68	\n"	// SETBNK: load to bank 0, name is in bank 0
+	);
+	if (cbm_load(overlay_name, program_device, NULL) == 0) {
+		print(COLOR_EMPH "\n  Could not load ");
+		print(overlay_name);
+		print(".\n" COLOR_STD);
+		key_ask();
+		return 1;
+	}
+	overlay_loaded = number;
+	return 0;
+}
+
 // show program info
+#pragma code-name (push, "OVERLAY1")
+#pragma rodata-name (push, "OVERLAY1")
 static void help_show(void)
 {
 	print(
@@ -304,6 +626,8 @@ static void help_show(void)
 	);
 	key_ask();
 }
+#pragma rodata-name (pop)
+#pragma code-name (pop)
 
 // enter boot message
 static const char	string_hhc[]	= {c_HOME, c_HOME, c_CLEAR, 0};
@@ -311,6 +635,7 @@ static void message_enter(void)
 {
 	static uint8_t	byte;
 
+	screen_save();
 	colors_system();
 	print(string_hhc);
 	print(
@@ -348,88 +673,10 @@ static void message_enter(void)
 	if (conf.use_local_charset)
 		localcharset_off();
 	colors_own();	// user might have changed text color or switched screen
-	redraw_screen = 1;
-}
-
-// replacement for basic's string handling: use a global buffer and functions
-// to append various stuff
-#define BUFFER_MAX	((uint8_t) 255)	// content length may be 0..255
-static uint8_t	buf_used	= 0;
-static char	buffer[BUFFER_MAX + 1];	// but buffer is a full page so terminator can be added
-
-// add a single byte
-static void __fastcall__ buf_add_byte(uint8_t cc)
-{
-	if (buf_used >= BUFFER_MAX)
-		return;
-	buffer[buf_used] = cc;
-	++buf_used;
-}
-
-// add a sequence of bytes (may contain zeroes)
-static void __fastcall__ buf_add_seq(uint8_t size, const char *buf)
-{
-	while (size--)
-		buf_add_byte(*buf++);
-}
-
-// add a terminated string
-static void __fastcall__ buf_add_string(const char *string)
-{
-	static unsigned int	length;
-
-	length = 0;
-	while (string[length] != '\0')
-		++length;
-	if (length > BUFFER_MAX)
-		length = BUFFER_MAX;
-	buf_add_seq(length, string);
-}
-
-// add decimal representation of unsigned byte
-static void __fastcall__ buf_add_uint8dec99max(uint8_t byte)
-{
-	char	result[2];
-
-	// this code relies on cc65's argument stack handling...
-	(void) byte;	// inhibit compiler warning
-	asm(
-"		ldy #2		\n"
-"		lda (sp), y	\n"	// read parameter
-"		jsr $f9fb	\n"	// $f9fb converts uint8 in A to two ascii digits in XXAA (so only works in 0..99 range)
-"		ldy #1		\n"
-"		sta (sp), y	\n"	// write result[1]
-"		txa		\n"
-"		dey		\n"
-"		sta (sp), y	\n"	// write result[0]
-	);
-	// inhibit leading zero
-	if (result[0] == '0')
-		buf_add_byte(result[1]);
-	else
-		buf_add_seq(2, result);
+	if (screen_restore())
+		mark_dirty(DIRTY_ALL);	// switched, so both screens may have been used
 }
 
-// add prefix codes (according to config) and actual message
-static const char	string_epej[]	= { c_ESCAPE, 'p', c_ESCAPE, 'j', 0 };
-static void buf_add_message(void)
-{
-	if (conf.remove_boot_msg)
-		buf_add_string(string_epej);
-	if (conf.lock_charset)
-		buf_add_byte(c_LOCK);
-	switch (conf.force_case) {
-	case FORCE_NONE:
-		break;
-	case FORCE_LOWER:
-		buf_add_byte(c_LOWERCASE);
-		break;
-	case FORCE_UPPER:
-		buf_add_byte(c_UPPERCASE);
-		break;
-	}
-	buf_add_seq(message_len, message_buffer);
-}
 
 // display boot message
 static const char	string_uuhhc[]	= { c_UPPERCASE, c_UNLOCK, c_HOME, c_HOME, c_CLEAR, 0 };
@@ -437,6 +684,7 @@ static void message_display(void)
 {
 	static uint8_t	ii;
 
+	screen_save();
 	colors_system();
 	print(string_uuhhc);
 	if (conf.use_local_charset)
@@ -453,7 +701,8 @@ static void message_display(void)
 	if (conf.use_local_charset)
 		localcharset_off();
 	colors_own();
-	redraw_screen = 1;
+	if (screen_restore())
+		mark_dirty(DIRTY_ALL);	// switched, so both screens may have been used
 }
 
 // ask for decision
@@ -463,7 +712,7 @@ static bool chance_to_cancel(void)
 	print(COLOR_EMPH "[y/n]" COLOR_STD);
 	keybuf_clear();
 	for (;;) {
-		switch (cbm_k_getin()) {
+		switch (key_get()) {
 		case 'y':
 		case 'Y':
 			CHROUT('\n');
@@ -525,27 +774,73 @@ static void __fastcall__ error_decode(uint8_t code)
 // test for existence of drive (by open/chkout/close on command channel)
 // returns true if drive exists
 static uint8_t	device_to_check;
+// (uses its own logical file, so it can be done while other files are open)
 static bool drive_check(void)
 {
-	cbm_open(LFN_CMD, device_to_check, SA_CMD, "");
-	cbm_k_ckout(LFN_CMD);
+	cbm_open(LFN_SCAN, device_to_check, SA_SCAN, "");
+	cbm_k_ckout(LFN_SCAN);
 	cbm_k_clrch();
-	cbm_k_close(LFN_CMD);
+	cbm_k_close(LFN_SCAN);
 	return (cbm_k_readst() & 0x80) == 0;	// bit 7 means device not present
 }
 
+// bus scan task: checks one device per step
+static bool	drive_present[DEVICE_MAX + 1];
+static uint8_t	scan_device	= DEVICE_MIN;	// next device to check
+static bool	scan_complete;	// drive_present[] is valid
+static bool	scan_running;
+static bool scan_step(void)
+{
+	device_to_check = scan_device;
+	drive_present[scan_device] = drive_check();
+	if (++scan_device <= DEVICE_MAX)
+		return 0;	// not yet finished
+
+	scan_device = DEVICE_MIN;
+	scan_complete = 1;
+	scan_running = 0;
+	mark_dirty(DIRTY_DEVICE);	// remove "scanning"
+	return 1;	// finished
+}
+
+// start bus scan in background
+static void scan_start(void)
+{
+	scan_running = 1;
+	mark_dirty(DIRTY_DEVICE);	// show "scanning"
+	task_start(scan_step);
+}
+
 // find next available drive
+// if a scan has completed, the drives found are checked first (in case they
+// have been switched off). if none of them answers, all devices are checked,
+// so a drive switched on after the scan is found as well. then a new scan is
+// started to update the list.
 static void drive_next(void)
 {
+	static bool	known_only;
+
+	known_only = scan_complete;
 	device_to_check = chosen_device;
-	do {
+	for (;;) {
 		++device_to_check;
 		if (device_to_check > DEVICE_MAX)
 			device_to_check = DEVICE_MIN;
-		if (drive_check())
+		if (device_to_check == chosen_device) {
+			if (!known_only)
+				break;	// no other drive
+
+			known_only = 0;	// try the others as well
+			continue;
+		}
+		if (known_only && !drive_present[device_to_check])
+			continue;
+		drive_present[device_to_check] = drive_check();
+		if (drive_present[device_to_check])
 			break;
-	} while (device_to_check != chosen_device);
+	}
 	chosen_device = device_to_check;
+	scan_start();
 }
 
 // fetch and display drive status
@@ -572,380 +867,496 @@ static bool drive_get_status(void)
 	return buffer[0] != '0';
 }
 
-// check disc/partition type
-// result is in global var; returns true on error or unsupported drive
-static bool drive_get_dpt(void)
+// kernal transport for boot block core (see transport.h):
+// uses command channel and buffer channel of chosen device
+
+// returns true on error
+static bool kernal_open(void)
+{
+	static uint8_t	err;
+
+	//OPEN
+	err = cbm_open(LFN_CMD, chosen_device, SA_CMD, "i0");
+	if (err) {
+		cbm_close(LFN_CMD);	// if open fails, file must still be closed!
+		error_decode(err);
+		return 1;	// fail
+	}
+	//OPEN
+	err = cbm_open(LFN_BUF, chosen_device, SA_BUF, "#");
+	if (err) {
+		cbm_close(LFN_BUF);
+		cbm_close(LFN_CMD);
+		error_decode(err);
+		return 1;	// fail
+	}
+	return 0;	// ok
+}
+
+static void kernal_close(void)
+{
+	//CLOSE
+	cbm_close(LFN_BUF);
+	cbm_close(LFN_CMD);
+}
+
+// read first byte of raw directory
+// returns -1 on error
+static int kernal_format(void)
 {
 	static uint8_t	err;
 	static int	ret;
 	static uint8_t	format;
 
-	print("Checking drive/partition format.\n");
 	err = cbm_open(LFN_RAWDIR, chosen_device, SA_RAWDIR, "$");
 	if (err) {
 		cbm_close(LFN_RAWDIR);	// if open fails, file must still be closed!
 		error_decode(err);
-		return 1;	// fail
+		return -1;	// fail
 	}
 	ret = cbm_read(LFN_RAWDIR, &format, 1);
 	cbm_close(LFN_RAWDIR);
 	if (ret == -1) {
 		error_decode(_oserror);
-		return 1;	// fail
+		return -1;	// fail
 	}
 	if (ret == 0) {
 		// unexpected EOF - this happens with file system access under VICE
 		// or with "21,read error"s or "drive not ready"
 		print(COLOR_EMPH "  Error: No data." COLOR_STD "\n");
 		drive_get_status();	// ignore return value, we failed anyway
-		return 1;	// fail
+		return -1;	// fail
 	}
-	if (drive_get_status())
-		return 1;	// fail
+	return format;
+}
 
-	switch (format) {
-	case 'a':
-		dpt = &dpt_1541;
-		break;
-	case 'c':
-		dpt = &dpt_ieee;
-		break;
-	case 'd':
-		dpt = &dpt_1581;
-		break;
-	case 'h':
-		dpt = &dpt_cmdnative;
-		break;
-	case 'm':
-		dpt = &dpt_cmdextnat;
-		break;
-	case '\0':
-		dpt = &dpt_rawsd2iec;
-		break;
-	default:
-		dpt = &dpt_unknown;
-		break;
-	}
-	print("  Drive/partition has " COLOR_EMPH);
-	print(dpt->name);
-	print(COLOR_STD " format.\n");
-	if (dpt->valid)
-		return 0;	// ok
-
-	print("Sorry.\n\n");	// don't mess with unknown formats
-	return 1;	// fail
-}
-
-// build the new boot block in memory
-static const char	part1[]	= { 'c', 'b', 'm', 0, 0, 0, 0 };
-static const char	part2[]	= { 0, 0, 0xa2 };	// text terminator, filename terminator, "ldx #"
-static const char	part3[]	= { 0xa0, 0x0b, 0x4c, 0xa5, 0xaf };	// "ldy #$0b : jmp $afa5"
-static void bootblock_build(void)
-{
-	// put version msg at end of buffer
-	buf_used = 198;	// the string below takes 56 chars
-	buf_add_string(" This boot block was created by MacBootMake Version " VERSION ".\n");
-	// now create real data at start of buffer. version message may be overwritten, but that's ok.
-	buf_used = 0;	// clear buffer
-	buf_add_seq(7, part1);
-	buf_add_message();
-	buf_add_seq(3, part2);
-	buf_add_byte(5 + buf_used);	// depends on position (length of previous data)
-	buf_add_seq(5, part3);
-	// x/y is set to point to latest byte.
-	// calling $afa5 will increment pointer before using it,
-	// therefore further contents will be interpreted as basic.
-	if (conf.use_local_charset)
-		buf_add_string("poK0,111:poK1,51:");	// FIXME - convert to machine code?
-	buf_add_string("bA");	// bank
-	buf_add_uint8dec99max(conf.chosen_bank);
-	switch (conf.action) {
-	case ACTION_RUNBASIC:
-		buf_add_string(":rU\"");	// run
-		break;
-	case ACTION_BOOTMC:
-		buf_add_string(":bO\"");	// boot
-		break;
-	//case ACTION_GO64LOAD:		// TODO - this algo would need some more changes in this function...
-	//	break;
-	}
-	buf_add_string(filename_buf);
-	buf_add_string("\",u");
-	if (conf.alternative_device == ALTDEVICE_NONE) {
-		buf_add_string("(peE(186))");
-	} else {
-		buf_add_uint8dec99max(conf.alternative_device);
+// send drive command
+// returns true on error
+static bool kernal_command(const char *cmd, uint8_t len)
+{
+	if (cbm_write(LFN_CMD, cmd, len) == -1) {
+		error_decode(_oserror);
+		return 1;	// fail
 	}
-	buf_add_byte(0);	// end of basic line
-	buf_used = MSG_BUF_LEN;	// make sure whole buffer is sent to drive
+	return 0;	// ok
 }
 
-// send drive command (channel must be open)
-static uint8_t send_buf_as_cmd(void)
+// read from buffer channel
+// returns true on error
+static bool kernal_read(void *data, uint16_t len)
 {
 	static int	ret;
 
-	ret = cbm_write(LFN_CMD, buffer, buf_used);
+	ret = cbm_read(LFN_BUF, data, len);
 	if (ret == -1) {
 		error_decode(_oserror);
-		return 1;
+		return 1;	// fail
 	}
-	return 0;
+	if (ret != len) {
+		print(COLOR_EMPH "  Error: Unexpected EOF." COLOR_STD "\n");
+		return 1;	// fail
+	}
+	return 0;	// ok
 }
 
-// set drive buffer pointer (channels must be open, argument must be given as string)
-static uint8_t __fastcall__ set_buffer_pointer(const char *byte_offset)
+// write to buffer channel
+// returns true on error
+static bool kernal_write(const void *data, uint16_t len)
 {
-	buf_used = 0;	// clear buffer
-	buf_add_string("b-p " XSTR(SA_BUF) " ");
-	buf_add_string(byte_offset);
-	return send_buf_as_cmd();
-}
+	static int	ret;
 
-// send buffer contents to command channel and display drive status
-// return true on error
-static uint8_t send_and_check(void)
-{
-	if (send_buf_as_cmd())
+	ret = cbm_write(LFN_BUF, data, len);
+	if (ret == -1) {
+		error_decode(_oserror);
 		return 1;	// fail
-
-	if (drive_get_status())
+	}
+	if (ret != len) {
+		print(COLOR_EMPH "  Error: Could not write all data." COLOR_STD "\n");
 		return 1;	// fail
-
+	}
 	return 0;	// ok
 }
 
-// send block command (read/write) to disk drive (channels must be open)
-// track and sector must be given as string (space- or semicolon-separated)
-static uint8_t __fastcall__ block_usercmd(uint8_t action, const char *ts)
+static const struct transport	kernal_transport	= {
+	kernal_open,
+	kernal_close,
+	kernal_format,
+	kernal_command,
+	drive_get_status,
+	kernal_read,
+	kernal_write
+};
+
+// output and questions for boot block core (see bbcore.h)
+void __fastcall__ bb_print(const char *msg)
 {
-	buf_used = 0;	// clear buffer
-	buf_add_byte('u');
-	buf_add_byte(action);
-	buf_add_string(" " XSTR(SA_BUF) " 0 ");	// 0 is drive
-	buf_add_string(ts);
-	return send_and_check();
+	print(msg);
 }
 
-// tell disk drive to read a block into buffer
-// track and sector must be given as string (space- or semicolon-separated)
-#define block_read(ts)	block_usercmd('1', ts)
-
-// tell disk drive to write buffer to block
-// track and sector must be given as string (space- or semicolon-separated)
-#define block_write(ts)	block_usercmd('2', ts)
-
-// try to allocate t1s0
-// return true on error
-static bool bootblock_allocate(void)
+void __fastcall__ bb_error(const char *msg)
 {
-	print("Allocating boot block.\n");
-	buf_used = 0;
-	buf_add_string("b-a 0 1 0");
-	return send_and_check();
+	print(COLOR_EMPH "  Error: ");
+	print(msg);
+	print("." COLOR_STD "\n");
 }
 
-// try to free t1s0
-// return true on error
-static bool bootblock_free(void)
+static bool	cancelled;	// user said no, so no need to ask for key
+bool __fastcall__ bb_cancel(enum bbq question)
 {
-	print("Deallocating boot block.\n");
-	buf_used = 0;
-	buf_add_string("b-f 0 1 0");
-	return send_and_check();
+	switch (question) {
+	case BBQ_OVERWRITE:
+		CHROUT(c_BELL);
+		print(
+			"\nDisc already has a valid boot block!\n"
+			"\nContinue?\n"
+		);
+		break;
+	case BBQ_DATALOSS:
+		CHROUT(c_BELL);
+		print(
+			COLOR_EMPH
+			"\nBoot block is allocated; CONTINUING WILL RESULT IN DATA LOSS!\n"
+			"\nREALLY continue?\n"
+			COLOR_STD
+		);
+		break;
+	case BBQ_REMOVE:
+		print("Remove it?\n");
+		break;
+	}
+	cancelled = chance_to_cancel();
+	return cancelled;
 }
 
-// check whether boot block is allocated and active:
-// result is in global vars; returns true on error!
-static bool bootblock_check(void)
+// read program to embed into buffer and set up preloading
+// returns true on error
+static bool embed_read(void)
 {
+	static uint8_t	err,
+			extra;
 	static int	ret;
-	static uint8_t	allocation_byte;
-	static char	signature[3];
-
-	if (dpt->fiddle_with_bam) {
-		print("Checking BAM.\n");
-		if (block_read(dpt->track_and_sector))
-			return 1;	// fail
+	static bool	too_large;
 
-		if (set_buffer_pointer(dpt->byte_offset))
-			return 1;	// fail
-
-		ret = cbm_read(LFN_BUF, &allocation_byte, 1);
-		if (ret == -1) {
-			error_decode(_oserror);
-			return 1;	// fail
-		}
-		// boot block is sector 0, so check lsb:
-		if (allocation_byte & 1) {
-			allocation_state = AS_FREE;
-			print("  Boot block is not allocated.\n");
-		} else {
-			allocation_state = AS_ALLOCATED;
-			print("  Boot block is allocated.\n");
-		}
-	} else {
-		allocation_state = AS_RESERVED;
-		// FIXME - tell user why we don't care about allocation!
+	print("Reading program to embed.\n");
+	err = cbm_open(LFN_FILE, chosen_device, SA_FILE, filename_buf);
+	if (err) {
+		cbm_close(LFN_FILE);	// if open fails, file must still be closed!
+		error_decode(err);
+		return 1;	// fail
 	}
-	// check whether boot block is active:
-	print("Reading boot block.\n");
-	if (block_read("1 0"))
+	too_large = 0;
+	ret = cbm_read(LFN_FILE, &preload_addr, 2);
+	if (ret == 2) {
+		ret = cbm_read(LFN_FILE, preload_buf, sizeof(preload_buf));
+		// buffer full? then try to read one more byte
+		if (ret == sizeof(preload_buf))
+			too_large = cbm_read(LFN_FILE, &extra, 1) == 1;
+	} else if (ret != -1) {
+		ret = 0;	// not even a load address
+	}
+	cbm_close(LFN_FILE);
+	if (ret == -1) {
+		error_decode(_oserror);
 		return 1;	// fail
-
-	// set buffer pointer to zero
-	// FIXME - check whether old version works, because this was added!
-	if (set_buffer_pointer("0"))
+	}
+	if (drive_get_status())
 		return 1;	// fail
 
-	ret = cbm_read(LFN_BUF, signature, 3);
-	if (ret == -1) {
-		error_decode(_oserror);
+	if (ret == 0) {
+		print(COLOR_EMPH "  Error: No data." COLOR_STD "\n");
 		return 1;	// fail
 	}
-	if (ret != 3) {
-		print(COLOR_EMPH "  Error: Unexpected EOF." COLOR_STD "\n");
+	if (too_large) {
+		print(COLOR_EMPH "  Error: Program is too large to embed." COLOR_STD "\n");
+		return 1;	// fail
+	}
+	if (preload_addr < BOOTSECTOR_ADDR + 256) {
+		print(COLOR_EMPH "  Error: Load address is too low." COLOR_STD "\n");
 		return 1;	// fail
 	}
-	bootblock_active = (signature[0] == 'c') && (signature[1] == 'b') && (signature[2] == 'm');
+	embed_len = ret;
+	preload_count = (embed_len + 255) >> 8;
+	preload_bank = (preload_addr == BASIC_START) ? 0 : conf.chosen_bank;
+	preload_data = preload_buf;
 	return 0;	// ok
 }
 
-// create boot block ("inner" function)
-static void bba_create(void)
+// directory cache: closed programs of chosen device, read once from the raw
+// directory and then used by the file picker and the boot menu.
+// the cache is in bank 1, entries are copied via dircache_get().
+// the raw directory has 254 bytes per block (no link), the first block is
+// the header and in the others, entries start at offsets 0, 32, ..., 224.
+#define DIRENTRY_TYPE	0
+#define DIRENTRY_TRACK	1
+#define DIRENTRY_SECTOR	2
+#define DIRENTRY_NAME	3
+#define DIRENTRY_BLOCKS	28
+#define DIRENTRY_SIZE	30	// ...of the part needed here
+#define FILETYPE_CLOSEDPRG	0x82
+#define DIRCACHE_MAX	144	// a full 1541 directory, larger ones get truncated
+struct dircache_entry {
+	char		name[16];	// padded with shift-space
+	uint8_t		track,
+			sector;
+	uint16_t	blocks;
+};
+#pragma bss-name (push, "BANK1BSS")
+static struct dircache_entry	dircache[DIRCACHE_MAX];
+#pragma bss-name (pop)
+static struct dircache_entry	dircache_entry;	// copy of one entry in bank 0
+static uint8_t	dircache_count;
+static uint8_t	dircache_device;	// cache is for this device, 0 means invalid
+static bool	fixed_start;	// "f" was used, so loaders get track/sector of files
+
+// read raw directory of device into cache and show drive status
+// (command channel must be open to that device).
+// returns true on error
+static bool __fastcall__ dircache_read(uint8_t device)
 {
+	static uint8_t	err,
+			ii;
 	static int	ret;
+	static char	*dirent;
 
-	if (bootblock_check())
-		goto prompt;
-
-	if (bootblock_active) {
-		CHROUT(c_BELL);
-		print(
-			"\nDisc already has a valid boot block!\n"
-			"\nContinue?\n"
-		);
-		if (chance_to_cancel())
-			return;
-
-	} else {
-		if ((dpt->fiddle_with_bam) && (allocation_state == AS_ALLOCATED)) {
-			CHROUT(c_BELL);
-			print(
-				COLOR_EMPH
-				"\nBoot block is allocated; CONTINUING WILL RESULT IN DATA LOSS!\n"
-				"\nREALLY continue?\n"
-				COLOR_STD
-			);
-			if (chance_to_cancel())
-				return;
-
+	dircache_device = 0;
+	dircache_count = 0;
+	err = cbm_open(LFN_RAWDIR, device, SA_RAWDIR, "$");
+	if (err) {
+		cbm_close(LFN_RAWDIR);	// if open fails, file must still be closed!
+		error_decode(err);
+		return 1;	// fail
+	}
+	ret = cbm_read(LFN_RAWDIR, buffer, 254);	// skip header
+	while (ret == 254 && dircache_count < DIRCACHE_MAX) {
+		ret = cbm_read(LFN_RAWDIR, buffer, 254);
+		// eight entries per block
+		for (ii = 0; ii < 8 && (ii << 5) + DIRENTRY_SIZE <= ret && dircache_count < DIRCACHE_MAX; ++ii) {
+			dirent = buffer + (ii << 5);
+			if ((dirent[DIRENTRY_TYPE] & 0x87) != FILETYPE_CLOSEDPRG)
+				continue;
+			memcpy(dircache_entry.name, dirent + DIRENTRY_NAME, 16);
+			dircache_entry.track = dirent[DIRENTRY_TRACK];
+			dircache_entry.sector = dirent[DIRENTRY_SECTOR];
+			dircache_entry.blocks = (uint8_t) dirent[DIRENTRY_BLOCKS] | ((uint8_t) dirent[DIRENTRY_BLOCKS + 1] << 8);
+			bank1_stash(dircache + dircache_count, &dircache_entry, sizeof(dircache_entry));
+			++dircache_count;
 		}
 	}
-	if (set_buffer_pointer("0"))
-		goto prompt;
-
-	print("Writing boot block.\n");
-	bootblock_build();
-	ret = cbm_write(LFN_BUF, buffer, buf_used);
+	cbm_close(LFN_RAWDIR);
 	if (ret == -1) {
 		error_decode(_oserror);
-		goto prompt;
-	}
-	if (ret != buf_used) {
-		print(COLOR_EMPH "  Error: Could not write all data." COLOR_STD);
-		goto prompt;
+		return 1;	// fail
 	}
-	if (block_write("1 0"))
-		goto prompt;
+	if (drive_get_status())
+		return 1;	// fail
 
-	if ((dpt->fiddle_with_bam) && (allocation_state == AS_FREE)) {
-		if (bootblock_allocate())
-			goto prompt;
-	}
-	print("Done.\n");
-prompt:	key_ask();
+	dircache_device = device;
+	return 0;	// ok
 }
 
-// check/destroy boot block ("inner" function)
-static void bba_check(void)
+// copy cache entry to bank 0
+// returns pointer to copy, which is valid until the next call
+static struct dircache_entry * __fastcall__ dircache_get(uint8_t index)
 {
-	static int	ret;
-	static uint8_t	zero	= 0;
-
-	if (bootblock_check())
-		goto prompt;
+	bank1_fetch(&dircache_entry, dircache + index, sizeof(dircache_entry));
+	return &dircache_entry;
+}
 
-	if (bootblock_active == 0) {
-		print("  No active boot block.\n");
-		// TODO - if allocated, ask user whether to free?
-		goto prompt;
+// find program in cache, returns NULL if it is not there
+// (otherwise see dircache_get() for how long the result is valid)
+static struct dircache_entry * __fastcall__ dircache_find(const char *name)
+{
+	static uint8_t	ii,
+			len;
+	static struct dircache_entry	*entry;
+
+	len = strlen(name);
+	for (ii = 0; ii < dircache_count; ++ii) {
+		entry = dircache_get(ii);
+		if (memcmp(entry->name, name, len) == 0 && (len == 16 || entry->name[len] == '\xa0'))
+			return entry;
 	}
-	print(
-		"  Boot block found.\n"
-		"Remove it?\n"
-	);
-	// FIXME - if block is free, ask user whether to allocate!
-	if (chance_to_cancel())
-		return;
+	return NULL;
+}
 
-	// ok, now destroy it
-	if (set_buffer_pointer("0"))
-		goto prompt;
+// read directory and put programs into menu table of preload buffer.
+// track/sector are only filled in if the user asked for fixed starts (see
+// loader_preset_start()), otherwise the loaders search for the chosen name.
+// returns true on error
+static bool menu_read(void)
+{
+	static uint8_t	count,
+			ii;
+	static char	*entry;
+	static struct dircache_entry	*cached;
+
+	// the menu lists the boot device's directory
+	if (conf.alternative_device != ALTDEVICE_NONE) {
+		print(COLOR_EMPH "  Error: Boot menu cannot load from another device." COLOR_STD "\n");
+		return 1;	// fail
+	}
+	print("Reading directory for menu.\n");
+	if (dircache_read(chosen_device))
+		return 1;	// fail
 
-	ret = cbm_write(LFN_BUF, &zero, 1);	// overwriting first byte should be enough
-	if (ret == -1) {
-		error_decode(_oserror);
-		goto prompt;
+	count = dircache_count;
+	if (count == 0) {
+		print(COLOR_EMPH "  Error: No programs found." COLOR_STD "\n");
+		return 1;	// fail
 	}
-	if (ret == 0) {
-		print(COLOR_EMPH "  Error: Could not write all data." COLOR_STD);
-		goto prompt;
+	if (count > MENU_MAX)
+		count = MENU_MAX;
+	for (ii = 0; ii < count; ++ii) {
+		entry = preload_buf + MENU_TABLE + ii * MENU_ENTRY_SIZE;
+		cached = dircache_get(ii);
+		memcpy(entry, cached->name, 16);
+		entry[16] = fixed_start ? cached->track : 0;
+		entry[17] = fixed_start ? cached->sector : 0;
 	}
-	//print#LFN_CMD, "b-p " XSTR(SA_BUF) " 0"	this is useless, as i now realize. a data becker book said to do this...
-	if (block_write("1 0"))
-		goto prompt;
-
-	print("  Boot block deactivated.\n");
-	if ((dpt->fiddle_with_bam) && (allocation_state == AS_ALLOCATED)) {
-// FIXME - ask user, maybe they want to keep it allocated for later use!
-// but then, how do we recognize this the next time and do not scare user about data loss?
-// maybe use special "disabled" boot sector contents?
-		if (bootblock_free())
-			goto prompt;
+	preload_buf[MENU_COUNT] = count;
+	return 0;	// ok
+}
+
+// let loader start at file's track/sector instead of searching the directory.
+// this is only done if the user asked for it (key "f" or picking with "f"),
+// because the boot block breaks if the file gets saved again or replaced later.
+// the directory is read again, because the disc may have been changed.
+// returns true on error
+static bool loader_preset_start(void)
+{
+	static struct dircache_entry	*entry;
+
+	if (!fixed_start)
+		return 0;	// loader searches by name
+	if (conf.alternative_device != ALTDEVICE_NONE)
+		return 0;	// file is on another disc, so loader must search
+
+	print("Reading directory for start of file.\n");
+	if (dircache_read(chosen_device))
+		return 1;	// fail
+
+	entry = dircache_find(filename_buf);
+	if (entry == NULL) {
+		print("  File not found, loader will search for it.\n");
+		return 0;	// ok, maybe file gets copied later
 	}
-	print("Done.\n");
-prompt:	key_ask();
+	preload_buf[LDR_TRACK] = entry->track;
+	preload_buf[LDR_SECTOR] = entry->sector;
+	return 0;	// ok
 }
 
-// wrapper function to create or destroy boot block
-static void __fastcall__ bootblock_action(void (*bbaction)(void))
+// copy loader image to preload buffer and fill in its parameter block
+static void __fastcall__ loader_prepare(const char *image, const char *image_end)
 {
-	static uint8_t	err;
+	static uint16_t	size;
+	static uint8_t	len;
+
+	size = image_end - image;
+	memcpy(preload_buf, image, size);
+	preload_buf[LDR_DEVICE] = (conf.alternative_device == ALTDEVICE_NONE) ? 0 : conf.alternative_device;
+	preload_buf[LDR_BANK] = conf.chosen_bank;
+	preload_buf[LDR_FLAGS] = bank_uses_ram1(conf.chosen_bank) ? LDRF_RAM1 : 0;
+	if (conf.timing == TIMING_START)
+		preload_buf[LDR_FLAGS] |= LDRF_TIMING;
+	len = strlen(filename_buf);
+	preload_buf[LDR_NAMELEN] = len;
+	memcpy(preload_buf + LDR_NAME, filename_buf, len);	// image has padding
+	buf_used = 0;
+	buf_add_runtext();
+	memcpy(preload_buf + LDR_RUNTEXT, buffer, buf_used);
+	preload_count = (size + 255) >> 8;
+	preload_addr = LOADER_ADDR;
+	preload_bank = 0;
+	preload_data = preload_buf;
+}
 
-	//OPEN
-	err = cbm_open(LFN_CMD, chosen_device, SA_CMD, "i0");
-	if (err) {
-		error_decode(err);
-		key_ask();
-		goto fail;
+// set up preloading for chosen action
+// returns true on error
+static bool preload_prepare(void)
+{
+	preload_count = 0;
+	preload_addr = 0;
+	preload_bank = 0;
+	switch (conf.action) {
+	case ACTION_EMBED:
+		return embed_read();
+
+	case ACTION_BURSTLOAD:
+		loader_prepare(burst_image, burst_image_end);
+		break;
+	case ACTION_FASTLOAD:
+		// 1541 family gets a 2-bit loader (which uses burst on 1571
+		// in native mode), all others support burst mode.
+		if (dpt == &dpt_1541) {
+			loader_prepare(fast1541_image, fast1541_image_end);
+			return loader_preset_start();
+		}
+		loader_prepare(burst_image, burst_image_end);
+		break;
+	case ACTION_GO64LOAD:
+		// same choice of transfer as above, file goes to RAM1 first
+		if (dpt == &dpt_1541)
+			loader_prepare(go64fast_image, go64fast_image_end);
+		else
+			loader_prepare(go64burst_image, go64burst_image_end);
+		preload_buf[LDR_BANK] = 1;
+		preload_buf[LDR_FLAGS] = LDRF_RAM1;
+		if (conf.drive_mode != DRIVEMODE_KEEP)
+			preload_buf[LDR_MODE] = (conf.drive_mode == DRIVEMODE_1541) ? '0' : '1';
+		if (dpt == &dpt_1541)
+			return loader_preset_start();
+		break;
+	case ACTION_MENU:
+		if (dpt == &dpt_1541)
+			loader_prepare(menu1541_image, menu1541_image_end);
+		else
+			loader_prepare(menuchain_image, menuchain_image_end);
+		return menu_read();
+
+	case ACTION_PACKED:
+		// file is decrunched with RAM0 visible (see unpack.inc)
+		if (bank_uses_ram1(conf.chosen_bank)) {
+			print(COLOR_EMPH "  Error: Packed programs cannot run in RAM1 banks." COLOR_STD "\n");
+			return 1;	// fail
+		}
+		loader_prepare(unpack_image, unpack_image_end);
+		break;
 	}
-	if (drive_get_dpt()) {
+	return 0;	// ok
+}
+
+// create boot block ("inner" function)
+static void bba_create(void)
+{
+	cancelled = 0;
+	if (busy_call(preload_prepare) == 0)
+		busy_call(bootblock_create);	// errors have been reported
+	if (!cancelled)
 		key_ask();
-		goto fail;
-	}
-	//OPEN
-	err = cbm_open(LFN_BUF, chosen_device, SA_BUF, "#");
-	if (err) {
-		error_decode(err);
+}
+
+// check/destroy boot block ("inner" function)
+static void bba_check(void)
+{
+	cancelled = 0;
+	busy_call(bootblock_remove);	// errors have been reported
+	if (!cancelled)
+		key_ask();
+}
+
+// wrapper function to create or destroy boot block
+static void __fastcall__ bootblock_action(void (*bbaction)(void))
+{
+	transport = &kernal_transport;
+	if (busy_call(transport->open)) {
 		key_ask();
 	} else {
-		bbaction();
+		if (busy_call(drive_get_dpt))
+			key_ask();
+		else
+			bbaction();
+		transport->close();
 	}
-	//CLOSE
-	cbm_close(LFN_BUF);
-fail:	//CLOSE
-	cbm_close(LFN_CMD);
 }
 
 // create boot block
@@ -962,6 +1373,8 @@ static void check_for_existing_bb(void)
 
 // display directory (calls basic rom) and then drive status
 #define LFN_DIR	0	// just like $a0a4 does it
+#pragma code-name (push, "OVERLAY2")
+#pragma rodata-name (push, "OVERLAY2")
 static void show_directory(void)
 {
 	static uint8_t	err;
@@ -985,8 +1398,12 @@ static void show_directory(void)
 	cbm_close(LFN_CMD);	// if open fails, file must still be closed!
 	key_ask();
 }
+#pragma rodata-name (pop)
+#pragma code-name (pop)
 
 // send command to drive and then display drive status
+#pragma code-name (push, "OVERLAY3")
+#pragma rodata-name (push, "OVERLAY3")
 static void send_disc_command(void)
 {
 	static uint8_t	err;
@@ -1002,6 +1419,214 @@ static void send_disc_command(void)
 	cbm_close(LFN_CMD);	// if open fails, file must still be closed!
 	key_ask();
 }
+#pragma rodata-name (pop)
+#pragma code-name (pop)
+
+// boot timing: show record of last boot (see TIMING_ADDR), add it to log
+// file on disc and summarize that file.
+// log entries are the jiffy clock value at start of boot code and the time
+// from there to the start of the program, also in jiffies (three bytes each,
+// high byte first, zero if not recorded).
+#define TIMING_LOG	"bootlog"
+#define LOG_ENTRY_SIZE	6
+#define PALNTSC		0x0a03	// $ff on PAL machines
+#define CYCLES_PAL	(985248 / 60)	// cia clock cycles per jiffy
+#define CYCLES_NTSC	(1022727 / 60)
+#pragma code-name (push, "OVERLAY4")
+#pragma rodata-name (push, "OVERLAY4")
+static uint32_t __fastcall__ jiffies(const uint8_t *clock)
+{
+	return ((uint32_t) clock[0] << 16) | ((uint16_t) clock[1] << 8) | clock[2];
+}
+
+// convert cia 2 timer value of timing record to jiffies since boot code start
+static uint32_t __fastcall__ timer_jiffies(const uint8_t *timer)
+{
+	static uint32_t	cycles;
+
+	cycles = timer[0] | ((uint16_t) timer[1] << 8) | ((uint32_t) timer[2] << 16) | ((uint32_t) timer[3] << 24);
+	if (cycles == 0)
+		return 0;	// not recorded
+
+	return ~cycles / (PEEK(PALNTSC) ? CYCLES_PAL : CYCLES_NTSC) + 1;	// so it cannot be zero
+}
+
+// print number of jiffies as seconds with two decimals
+static void __fastcall__ print_seconds(uint32_t jiffies)
+{
+	static uint32_t	secs;
+	static uint8_t	hundredths,
+			ii;
+	static char	digits[12];
+
+	secs = jiffies / 60;
+	hundredths = (uint16_t) (jiffies % 60) * 5 / 3;
+	ii = sizeof(digits) - 1;
+	digits[ii] = '\0';
+	digits[--ii] = 's';
+	digits[--ii] = '0' + hundredths % 10;
+	digits[--ii] = '0' + hundredths / 10;
+	digits[--ii] = '.';
+	do {
+		digits[--ii] = '0' + secs % 10;
+		secs /= 10;
+	} while (secs);
+	print(digits + ii);
+}
+
+// print minimum, average and maximum
+static void __fastcall__ print_range(const char *what, uint32_t min, uint32_t sum, uint16_t count, uint32_t max)
+{
+	print(what);
+	print_seconds(min);
+	print("/");
+	print_seconds(sum / count);
+	print("/");
+	print_seconds(max);
+	print("\n");
+}
+
+// add entry to log file (command channel must be open)
+// returns true on error
+static bool __fastcall__ timing_append(const uint8_t *record)
+{
+	static uint8_t	err,
+			entry[LOG_ENTRY_SIZE];
+	static uint32_t	time;
+
+	memcpy(entry, record + TIMING_ENTRY_OFFSET, 3);
+	time = timer_jiffies(record + TIMING_START_OFFSET);
+	entry[3] = time >> 16;
+	entry[4] = time >> 8;
+	entry[5] = time;
+
+	print("Adding to log file.\n");
+	err = cbm_open(LFN_FILE, chosen_device, SA_FILE, TIMING_LOG ",s,a");
+	if (err == 0 && drive_get_status() && buffer[0] == '6' && buffer[1] == '2') {
+		// file not found, so create it
+		cbm_close(LFN_FILE);
+		err = cbm_open(LFN_FILE, chosen_device, SA_FILE, TIMING_LOG ",s,w");
+		if (err == 0 && drive_get_status()) {
+			cbm_close(LFN_FILE);
+			return 1;	// fail
+		}
+	}
+	if (err) {
+		cbm_close(LFN_FILE);	// if open fails, file must still be closed!
+		error_decode(err);
+		return 1;	// fail
+	}
+	if (cbm_write(LFN_FILE, entry, LOG_ENTRY_SIZE) != LOG_ENTRY_SIZE) {
+		cbm_close(LFN_FILE);
+		error_decode(_oserror);
+		return 1;	// fail
+	}
+	cbm_close(LFN_FILE);
+	return drive_get_status();
+}
+
+// read log file and show min/avg/max (command channel must be open)
+static void timing_summary(void)
+{
+	static uint8_t	entry[LOG_ENTRY_SIZE];
+	static uint8_t	err;
+	static uint16_t	count,
+			started;
+	static uint32_t	time,
+			code_min,
+			code_sum,
+			code_max,
+			prg_min,
+			prg_sum,
+			prg_max;
+
+	print("\nReading log file.\n");
+	err = cbm_open(LFN_FILE, chosen_device, SA_FILE, TIMING_LOG ",s,r");
+	if (err) {
+		cbm_close(LFN_FILE);	// if open fails, file must still be closed!
+		error_decode(err);
+		return;
+	}
+	if (drive_get_status()) {
+		cbm_close(LFN_FILE);
+		return;
+	}
+	count = 0;
+	started = 0;
+	code_min = prg_min = 0xffffffff;
+	code_sum = prg_sum = 0;
+	code_max = prg_max = 0;
+	while (cbm_read(LFN_FILE, entry, LOG_ENTRY_SIZE) == LOG_ENTRY_SIZE) {
+		++count;
+		time = jiffies(entry);
+		code_sum += time;
+		if (time < code_min)
+			code_min = time;
+		if (time > code_max)
+			code_max = time;
+		if (jiffies(entry + 3) == 0)
+			continue;	// start of program was not recorded
+
+		++started;
+		time = jiffies(entry + 3);
+		prg_sum += time;
+		if (time < prg_min)
+			prg_min = time;
+		if (time > prg_max)
+			prg_max = time;
+	}
+	cbm_close(LFN_FILE);
+	buf_used = 0;
+	buf_add_string("Boots in log: ");
+	buf_add_uint8dec99max(count > 99 ? 99 : count);
+	buf_add_string(count > 99 ? "+\n" : "\n");
+	buf_add_byte('\0');
+	print(buffer);
+	if (count == 0)
+		return;
+
+	print(" (min/avg/max)\n");
+	print_range(" Boot code: ", code_min, code_sum, count, code_max);
+	if (started)
+		print_range(" Program:  +", prg_min, prg_sum, started, prg_max);
+}
+
+static void timing_show(void)
+{
+	static uint8_t	record[TIMING_SIZE];
+	static uint8_t	err;
+
+	print("Last boot:\n");
+	memcpy(record, (void *) TIMING_ADDR, TIMING_SIZE);
+	err = cbm_open(LFN_CMD, chosen_device, SA_CMD, "");	// CAUTION - do not use NULL if no filename!
+	if (err) {
+		cbm_close(LFN_CMD);	// if open fails, file must still be closed!
+		error_decode(err);
+		key_ask();
+		return;
+	}
+	if (record[0] != TIMING_MAGIC || record[1] != (uint8_t) ~TIMING_MAGIC) {
+		print("  Nothing recorded.\n");
+	} else {
+		print("  Boot code started at ");
+		print_seconds(jiffies(record + TIMING_ENTRY_OFFSET));
+		print("\n");
+		if (timer_jiffies(record + TIMING_START_OFFSET)) {
+			print("  Program started ");
+			print_seconds(timer_jiffies(record + TIMING_START_OFFSET));
+			print(" later\n");
+		}
+		print("\n  a    Add to log file \"" TIMING_LOG "\"\n"
+			"other  Skip\n");
+		if (key_get() == 'a' && timing_append(record) == 0)
+			POKE(TIMING_ADDR, 0);	// so it does not get added twice
+	}
+	timing_summary();
+	cbm_close(LFN_CMD);
+	key_ask();
+}
+#pragma rodata-name (pop)
+#pragma code-name (pop)
 
 // set program name
 static void program_setfilename(void)
@@ -1012,24 +1637,155 @@ static void program_setfilename(void)
 	printat(0, 1, "File name:" COLOR_EMPH);
 	input(FILENAME_BUF_LEN, filename_buf);
 	print("\n" COLOR_STD);
+	fixed_start = 0;	// name may have been changed
+}
+
+// file picker: select program from directory cache
+#define PICK_Y		2	// screen line of first entry
+#define PICK_LINES	20
+// directory is read from the device the boot block will load from
+#define PICK_DEVICE	((conf.alternative_device == ALTDEVICE_NONE) ? chosen_device : conf.alternative_device)
+static uint8_t	pick_top,	// first entry on screen
+		pick_current;	// selected entry
+
+// read directory for file picker
+// returns true on error
+static bool pick_read(void)
+{
+	static uint8_t	err;
+	static bool	failed;
+
+	CHROUT(c_CLEAR);
+	print("Reading directory.\n");
+	pick_top = 0;
+	pick_current = 0;
+	err = cbm_open(LFN_CMD, PICK_DEVICE, SA_CMD, "");	// CAUTION - do not use NULL if no filename!
+	if (err) {
+		cbm_close(LFN_CMD);	// if open fails, file must still be closed!
+		error_decode(err);
+		return 1;	// fail
+	}
+	failed = dircache_read(PICK_DEVICE);
+	cbm_close(LFN_CMD);
+	return failed;
 }
 
-// call function in sidescreen
-static const char	string_et[]	= { c_ESCAPE, 't', 0 };
-static const char	string_is[]	= { c_CLEAR, c_LOWERCASE, c_HOME, c_HOME, 0 };
-static void __fastcall__ in_sidescreen(void (*fn)(void))
+// show entry: blocks and quoted name, selected entry in reverse
+static void __fastcall__ pick_line(uint8_t index)
+{
+	static struct dircache_entry	*entry;
+	static uint16_t	blocks;
+	static uint8_t	ii,
+			cc;
+	static char	digits[5];
+
+	entry = dircache_get(index);
+	buf_used = 0;
+	if (index == pick_current)
+		buf_add_byte(c_RVSON);
+	blocks = entry->blocks;
+	ii = sizeof(digits);
+	do {
+		digits[--ii] = '0' + blocks % 10;
+		blocks /= 10;
+	} while (blocks);
+	buf_add_seq(sizeof(digits) - ii, digits + ii);
+	for (; ii; --ii)
+		buf_add_byte(' ');
+	buf_add_string(" \"");
+	for (ii = 0; ii < 16 && (cc = entry->name[ii]) != 0xa0; ++ii)
+		buf_add_byte(((cc & 0x7f) < 0x20) ? '?' : cc);	// no control codes
+	buf_add_byte('"');
+	buf_add_byte(c_RVSOFF);
+	buf_add_byte(c_ESCAPE);	// clear rest of line
+	buf_add_byte('q');
+	buffer[buf_used] = '\0';
+	gotoxy(0, PICK_Y + index - pick_top);
+	print(buffer);
+}
+
+static void program_pick(void)
+{
+	static uint8_t	key,
+			ii,
+			previous;
+	static bool	full;	// redraw whole list
+	static char	*name;
+
+	if (dircache_device != PICK_DEVICE && busy_call(pick_read)) {
+		key_ask();
+		return;
+	}
+	full = 1;
+	for (;;) {
+		if (dircache_count == 0) {
+			print(COLOR_EMPH "  Error: No programs found." COLOR_STD "\n");
+			key_ask();
+			return;
+		}
+		// scroll if selected entry is not on screen
+		if (pick_current < pick_top) {
+			pick_top = pick_current;
+			full = 1;
+		} else if (pick_current >= pick_top + PICK_LINES) {
+			pick_top = pick_current - (PICK_LINES - 1);
+			full = 1;
+		}
+		if (full) {
+			CHROUT(c_CLEAR);
+			print("Pick file from directory:");
+			for (ii = pick_top; ii < dircache_count && ii < pick_top + PICK_LINES; ++ii)
+				pick_line(ii);
+			printat(0, PICK_Y + PICK_LINES + 1, "CRSR/RETURN: pick, r: read again,\nf: pick, fixed start (*), STOP: cancel");
+			full = 0;
+		} else {
+			pick_line(previous);
+			pick_line(pick_current);
+		}
+		previous = pick_current;
+		key = key_get();
+		switch (key) {
+		case c_CRSR_DOWN:
+			if (pick_current + 1 < dircache_count)
+				++pick_current;
+			break;
+		case c_CRSR_UP:
+			if (pick_current)
+				--pick_current;
+			break;
+		case 'r':
+			if (busy_call(pick_read)) {
+				key_ask();
+				return;
+			}
+			full = 1;
+			break;
+		case 'f':	// loader does not search, see loader_preset_start()
+		case c_RETURN:
+			fixed_start = (key == 'f');
+			name = dircache_get(pick_current)->name;
+			for (ii = 0; ii < 16 && name[ii] != '\xa0'; ++ii)
+				filename_buf[ii] = name[ii];
+			filename_buf[ii] = '\0';
+			return;
+		case c_STOP:
+			return;
+		}
+	}
+}
+
+// call function in sidescreen (after loading its overlay, if any)
+static void __fastcall__ in_sidescreen(uint8_t overlay, void (*fn)(void))
 {
 	// enter sidescreen
-	if (ON_VDC)
-		printat(40, 0, string_et);
-	else
-		redraw_screen = 1;
+	screen_save();
 	CHROUT(c_CLEAR);
 	// call function
-	fn();
+	if (overlay_load(overlay) == 0)
+		fn();
 	// leave sidescreen
-	if (ON_VDC)
-		print(string_is);
+	if (screen_restore())
+		mark_dirty(DIRTY_ALL);	// user switched screens during input
 }
 
 // redraw functions for boot block config:
@@ -1041,129 +1797,193 @@ static const char	remove_it[]	= COLOR_EMPH "remove it";
 static const char	block_it[]	= COLOR_EMPH "block it";
 static const char	line_tail[]	= COLOR_STD "\x1bq";	// { c_ESCAPE, 'q', 0 };
 #define CONF_X	21	// x position of config values
-#define CONF_Y	17	// y position of top config value
+#define CONF_Y	15	// y position of top config value
+// config lines (also used for dirty bits)
+#define CONFLINE_LOCALCHARSET	0
+#define CONFLINE_REMOVEBOOTMSG	1
+#define CONFLINE_LOCKCHARSET	2
+#define CONFLINE_FORCECASE	3
+#define CONFLINE_ACTION		4
+#define CONFLINE_FILENAME	5
+#define CONFLINE_ALTDEVICE	6
+#define CONFLINE_CHOSENBANK	7
+#define CONFLINE_DRIVEMODE	8
+#define CONFLINE_TIMING		9
+#define CONFLINES		10
 
 // redraw drive address
 static void device_redraw(void)
 {
-	printat(7, 0, COLOR_EMPH);
+	drawat(7, 0, COLOR_EMPH);
 	buf_used = 0;
 	buf_add_uint8dec99max(chosen_device);
 	buf_add_byte(' ');	// make sure to erase second digit from before
 	buf_add_byte('\0');
-	print(buffer);
-	print(COLOR_STD);
+	draw(buffer);
+	draw(scan_running ? COLOR_STD " scanning" : COLOR_STD "         ");
 }
 
 // redraw "use local charset" option
 static void uselocalcharset_redraw(void)
 {
-	gotoxy(CONF_X, CONF_Y + 0);
-	print(conf.use_local_charset ? activate_it : leave_alone);
-	print(line_tail);
+	draw_goto(CONF_X, CONF_Y + CONFLINE_LOCALCHARSET);
+	draw(conf.use_local_charset ? activate_it : leave_alone);
+	draw(line_tail);
 }
 
 // redraw "remove BOOTING" option
 static void removebootmsg_redraw(void)
 {
-	gotoxy(CONF_X, CONF_Y + 1);
-	print(conf.remove_boot_msg ? remove_it : leave_alone);
-	print(line_tail);
+	draw_goto(CONF_X, CONF_Y + CONFLINE_REMOVEBOOTMSG);
+	draw(conf.remove_boot_msg ? remove_it : leave_alone);
+	draw(line_tail);
 }
 
 // redraw "forbid cbm/shift" option
 static void lockcharset_redraw(void)
 {
-	gotoxy(CONF_X, CONF_Y + 2);
-	print(conf.lock_charset ? block_it : leave_alone);
-	print(line_tail);
+	draw_goto(CONF_X, CONF_Y + CONFLINE_LOCKCHARSET);
+	draw(conf.lock_charset ? block_it : leave_alone);
+	draw(line_tail);
 }
 
 // redraw "force upper/lower case" option
 static void forcecase_redraw(void)
 {
-	gotoxy(CONF_X, CONF_Y + 3);
+	draw_goto(CONF_X, CONF_Y + CONFLINE_FORCECASE);
 	switch (conf.force_case) {
 	case FORCE_NONE:
-		print(leave_alone);
+		draw(leave_alone);
 		break;
 	case FORCE_LOWER:
-		print(COLOR_EMPH "use lower case");
+		draw(COLOR_EMPH "use lower case");
 		break;
 	case FORCE_UPPER:
-		print(COLOR_EMPH "use upper case");
+		draw(COLOR_EMPH "use upper case");
 		break;
 	}
-	print(line_tail);
+	draw(line_tail);
 }
 
 // redraw "basic/machine code" option
 static void action_redraw(void)
 {
-	gotoxy(CONF_X, CONF_Y + 4);
+	draw_goto(CONF_X, CONF_Y + CONFLINE_ACTION);
 	switch (conf.action) {
 	case ACTION_RUNBASIC:
-		print(COLOR_EMPH "run basic prg");
+		draw(COLOR_EMPH "run basic prg");
 		break;
 	case ACTION_BOOTMC:
-		print(COLOR_EMPH "run machine prg");
+		draw(COLOR_EMPH "run machine prg");
+		break;
+	case ACTION_EMBED:
+		draw(COLOR_EMPH "embedded prg");
+		break;
+	case ACTION_BURSTLOAD:
+		draw(COLOR_EMPH "burst load prg");
+		break;
+	case ACTION_FASTLOAD:
+		draw(COLOR_EMPH "fast load prg");
+		break;
+	case ACTION_GO64LOAD:
+		draw(COLOR_EMPH "run c64 prg");
+		break;
+	case ACTION_MENU:
+		draw(COLOR_EMPH "boot menu");
+		break;
+	case ACTION_PACKED:
+		draw(COLOR_EMPH "packed prg");
 		break;
-	//case ACTION_GO64LOAD:
-	//	print(COLOR_EMPH "run c64 prg");
-	//	break;
 	}
-	print(line_tail);
+	draw(line_tail);
 }
 
 // redraw filename
+// (this still uses CHROUT, because the editor's quote mode shows control
+// codes in the name)
 static void filename_redraw(void)
 {
-	printat(CONF_X, CONF_Y + 5, "\"\x1b\x1b" COLOR_EMPH);
+	printat(CONF_X, CONF_Y + CONFLINE_FILENAME, "\"\x1b\x1b" COLOR_EMPH);
 	print(filename_buf);
 	print(COLOR_STD "\"\x1b\x1b");
+	if (fixed_start)
+		print("*");
 	print(line_tail);
 }
 
 // redraw alternative device
 static void altdevice_redraw(void)
 {
-	gotoxy(CONF_X, CONF_Y + 6);
+	draw_goto(CONF_X, CONF_Y + CONFLINE_ALTDEVICE);
 	if (conf.alternative_device == ALTDEVICE_NONE) {
-		print(COLOR_EMPH "boot device");
+		draw(COLOR_EMPH "boot device");
 	} else {
 		buf_used = 0;
 		buf_add_string(COLOR_EMPH "device ");
 		buf_add_uint8dec99max(conf.alternative_device);
 		buf_add_byte('\0');
-		print(buffer);
+		draw(buffer);
 	}
-	print(line_tail);
+	draw(line_tail);
 }
 
 // redraw bank option
 static void chosenbank_redraw(void)
 {
-	printat(CONF_X, CONF_Y + 7, COLOR_EMPH);
+	drawat(CONF_X, CONF_Y + CONFLINE_CHOSENBANK, COLOR_EMPH);
 	buf_used = 0;
 	buf_add_uint8dec99max(conf.chosen_bank);
 	buf_add_byte(' ');	// make sure to erase second digit from before
 	buf_add_byte('\0');
-	print(buffer);
-	print(COLOR_STD);
+	draw(buffer);
+	draw(COLOR_STD);
 }
 
-// redraw whole screen
-// CR at start ensures quote mode is off
-static char	string_init[]	= { 13, 27, 'n', c_LOCK, c_LOWERCASE, c_HOME, c_HOME, c_CLEAR, 0 };
+// redraw c64 drive mode option
+static void drivemode_redraw(void)
+{
+	draw_goto(CONF_X, CONF_Y + CONFLINE_DRIVEMODE);
+	switch (conf.drive_mode) {
+	case DRIVEMODE_KEEP:
+		draw(leave_alone);
+		break;
+	case DRIVEMODE_1541:
+		draw(COLOR_EMPH "send u0>m0");
+		break;
+	case DRIVEMODE_1571:
+		draw(COLOR_EMPH "send u0>m1");
+		break;
+	}
+	draw(line_tail);
+}
+
+// redraw boot timing option
+static void timing_redraw(void)
+{
+	draw_goto(CONF_X, CONF_Y + CONFLINE_TIMING);
+	switch (conf.timing) {
+	case TIMING_OFF:
+		draw(COLOR_EMPH "off");
+		break;
+	case TIMING_ENTRY:
+		draw(COLOR_EMPH "record boot");
+		break;
+	case TIMING_START:
+		draw(COLOR_EMPH "record boot+start");
+		break;
+	}
+	draw(line_tail);
+}
+
+// clear screen and draw static text
 static void screen_redraw(void)
 {
 	print(string_init);
-	print("Device:");
-	device_redraw();
-	printat(22, 0,		REVSON " MacBootMake V" VERSION " " REVSOFF "\n"
+	draw_rvs = 0;
+	drawat(0, 0, COLOR_STD "Device:");
+	drawat(22, 0,		REVSON " MacBootMake V" VERSION " " REVSOFF "\n"
 		"\n"
 		" Key:      Action:\n"
-		"\n"
 //		" -/+   Change device address\n"
 		"CTRL-d Cycle through available drives\n"
 		"  e    Enter message text\n"
@@ -1177,24 +1997,49 @@ static void screen_redraw(void)
 		"  q    Quit\n"
 		"\n"
 		"           Boot block configuration:\n"
-		"\n"
 		"  1    Local charset\n"
 		"  2    \"BOOTING\"\n"
 		"  3    CBM/Shift\n"
 		"  4    Case\n"
 		"  5    Boot action\n"
-		"  6    File name\n"
+		" 6/p   File name\n"
 		" 7/8   From\n"
-		" 9/0   Run in bank"
+		" 9/0   Run in bank\n"
+		"  m    C64 drive mode\n"
+		" t/T   Boot timing"
 	);
-	uselocalcharset_redraw();
-	removebootmsg_redraw();
-	lockcharset_redraw();
-	forcecase_redraw();
-	action_redraw();
-	filename_redraw();
-	altdevice_redraw();
-	chosenbank_redraw();
+}
+
+// paint everything that changed since the last call
+static void (* const confline_redraw[CONFLINES])(void)	= {
+	uselocalcharset_redraw,
+	removebootmsg_redraw,
+	lockcharset_redraw,
+	forcecase_redraw,
+	action_redraw,
+	filename_redraw,
+	altdevice_redraw,
+	chosenbank_redraw,
+	drivemode_redraw,
+	timing_redraw
+};
+static void screen_update(void)
+{
+	static uint16_t	bits;
+	static uint8_t	ii;
+
+	bits = dirty[SCREEN_INDEX];
+	dirty[SCREEN_INDEX] = 0;
+	if (bits & DIRTY_STATIC)
+		screen_redraw();
+	if (bits & DIRTY_DEVICE)
+		device_redraw();
+	for (ii = 0; ii < CONFLINES; ++ii) {
+		if (bits & dirty_conf(ii))
+			confline_redraw[ii]();
+	}
+	if (bits & DIRTY_STATIC)
+		CHROUT(c_HOME);
 }
 
 // wait for valid key and act upon
@@ -1207,53 +2052,63 @@ static void menu_loop(void)
 		if (key)
 			previous = key;
 		key = cbm_k_getin();
+		if (key == 0) {
+			// idle, so let tasks work and show their results
+			task_step();
+			screen_update();
+		}
 		switch (key) {
 		case c_CONTROL_D:	// scan for next device
 			drive_next();
-			device_redraw();
+			mark_dirty(DIRTY_DEVICE);
 			break;
 		case '1':	// toggle local charset usage
 			conf.use_local_charset = !conf.use_local_charset;
-			uselocalcharset_redraw();
+			mark_dirty(dirty_conf(CONFLINE_LOCALCHARSET));
 			break;
 		case '2':	// hide 'booting'?
 			conf.remove_boot_msg = !conf.remove_boot_msg;
-			removebootmsg_redraw();
+			mark_dirty(dirty_conf(CONFLINE_REMOVEBOOTMSG));
 			break;
 		case '3':	// cbm/shift?
 			conf.lock_charset = !conf.lock_charset;
-			lockcharset_redraw();
+			mark_dirty(dirty_conf(CONFLINE_LOCKCHARSET));
 			break;
 		case '4':	// force case?
 			++conf.force_case;
 			if (conf.force_case == FORCELIMIT)
 				conf.force_case = 0;
-			forcecase_redraw();
+			mark_dirty(dirty_conf(CONFLINE_FORCECASE));
 			break;
 		case '5':	// set action
 			++conf.action;
 			if (conf.action == ACTIONLIMIT)
 				conf.action = 0;
-			action_redraw();
+			mark_dirty(dirty_conf(CONFLINE_ACTION));
 			break;
 		case '6':
-			in_sidescreen(program_setfilename);
-			// there is no need to redraw component now if a full
-			// redraw is scheduled anyway (depends on sidescreen):
-			if (!redraw_screen)
-				filename_redraw();
+			in_sidescreen(OVERLAY_NONE, program_setfilename);
+			mark_dirty(dirty_conf(CONFLINE_FILENAME));
+			break;
+		case 'p':	// pick file name from directory
+			in_sidescreen(OVERLAY_NONE, program_pick);
+			mark_dirty(dirty_conf(CONFLINE_FILENAME));
+			break;
+		case 'f':	// fixed start track/sector, see loader_preset_start()
+			fixed_start = !fixed_start;
+			mark_dirty(dirty_conf(CONFLINE_FILENAME));
 			break;
 		case '7':	// decrement alternative device number
 			--conf.alternative_device;
 			if (conf.alternative_device < ALTDEVICE_MIN)
 				conf.alternative_device = ALTDEVICE_MAX;
-			altdevice_redraw();
+			mark_dirty(dirty_conf(CONFLINE_ALTDEVICE));
 			break;
 		case '8':	// increment alternative device number
 			++conf.alternative_device;
 			if (conf.alternative_device > ALTDEVICE_MAX)
 				conf.alternative_device = ALTDEVICE_MIN;
-			altdevice_redraw();
+			mark_dirty(dirty_conf(CONFLINE_ALTDEVICE));
 			break;
 		case '9':	// change bank
 			--conf.chosen_bank;
@@ -1262,10 +2117,25 @@ static void menu_loop(void)
 		case '0':	// change bank
 			++conf.chosen_bank;
 			conf.chosen_bank &= 15;
-			chosenbank_redraw();
+			mark_dirty(dirty_conf(CONFLINE_CHOSENBANK));
+			break;
+		case 'm':	// c64 drive mode
+			++conf.drive_mode;
+			if (conf.drive_mode == DRIVEMODELIMIT)
+				conf.drive_mode = 0;
+			mark_dirty(dirty_conf(CONFLINE_DRIVEMODE));
+			break;
+		case 't':	// boot timing
+			++conf.timing;
+			if (conf.timing == TIMINGLIMIT)
+				conf.timing = 0;
+			mark_dirty(dirty_conf(CONFLINE_TIMING));
+			break;
+		case 'T':	// show boot timing
+			in_sidescreen(OVERLAY_TIMING, timing_show);
 			break;
 		case 'i':
-			in_sidescreen(help_show);
+			in_sidescreen(OVERLAY_HELP, help_show);
 			break;
 		case 'e':
 			message_enter();
@@ -1274,17 +2144,19 @@ static void menu_loop(void)
 			message_display();
 			break;
 		case 's':
-			in_sidescreen(create_new_bb);
+			in_sidescreen(OVERLAY_NONE, create_new_bb);
 			break;
 //FIXME - change 'r' (remove) to 'c' (check)? and then ask user what to do (remove/load-to-buffer/ignore)?
 		case 'r':
-			in_sidescreen(check_for_existing_bb);
+			in_sidescreen(OVERLAY_NONE, check_for_existing_bb);
 			break;
 		case '$':
-			in_sidescreen(show_directory);
+			dircache_device = 0;	// disc may have been changed
+			in_sidescreen(OVERLAY_DIRECTORY, show_directory);
 			break;
 		case '@':
-			in_sidescreen(send_disc_command);
+			dircache_device = 0;	// command may have changed directory
+			in_sidescreen(OVERLAY_COMMAND, send_disc_command);
 			break;
 		case 'q':	// quit
 			quit_program = 1;
@@ -1293,12 +2165,12 @@ static void menu_loop(void)
 			break;
 		case 'x':
 			if (previous == c_ESCAPE) {
-				CHROUT(c_CLEAR);
+				// the other screen still shows the menu, so
+				// only the changes have to be painted there
 				asm(
 "					jsr $c02a	\n"	// switch video
 				);
 				colors_own();	// init screen colors
-				redraw_screen = 1;
 			}
 			break;
 		case 0:
@@ -1313,21 +2185,19 @@ static void menu_loop(void)
 // guess what
 int main(void)
 {
+	draw_init();
 	colors_own();	// also goes fast/slow depending on screen
-	chosen_device = PEEK(186);
-	if (chosen_device < DEVICE_MIN)
-		chosen_device = 8;
+	program_device = PEEK(186);
+	if (program_device < DEVICE_MIN)
+		program_device = 8;
+	chosen_device = program_device;
 	conf.alternative_device = ALTDEVICE_NONE;
 	conf.chosen_bank = 15;
-	redraw_screen = 1;
+	mark_dirty(DIRTY_ALL);
+	scan_start();
 	quit_program = 0;
 	do {
-		if (redraw_screen) {
-			screen_redraw();
-			//print("\nPlease press a key...");
-			CHROUT(c_HOME);
-			redraw_screen = 0;
-		}
+		screen_update();
 		menu_loop();
 	} while (!quit_program);
 	printat(0, 24, "\n\nCu...\n\n");
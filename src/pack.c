@@ -0,0 +1,340 @@
+// host-side packer for c128 programs, used to build the self-decrunching
+// version of macbootmake (see sfx.s) and for the "packed prg" boot action
+// (see unpack.inc). the decruncher is in decrunch.inc.
+//
+// usage:
+//	pack INFILE OUTFILE	pack program INFILE (load address $1c01, must
+//				start with a "sys" line) to packed stream
+//				OUTFILE and write parameters for sfx.s to stdout
+//	pack -p INFILE OUTFILE	pack program INFILE (any load address) to
+//				program OUTFILE for the "packed prg" boot action
+//	pack -r OLD NEW		report size and load time of OLD and NEW
+//
+// files written with -p hold the address to decrunch to (after their load
+// address), then the packed stream. the load address is chosen so that the
+// stream can be decrunched in place. neither the file nor the program may
+// touch the unpack code at $1300 or the i/o area.
+//
+// packed stream format (byte oriented, so the decruncher is fast):
+//	$00..$7e	literal run: this plus one bytes follow
+//	$7f		end of stream
+//	$80..$bf	short match: length is (this & $3f) + 2,
+//			one byte follows: offset - 1 (offset 1..256)
+//	$c0..$ff	long match: length is (this & $3f) + 3,
+//			two bytes follow: offset - 1, low byte first
+// offsets count backwards from current write position.
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOAD_ADDR	0x1c01	// c128 basic start
+#define MEMORY_END	0xff00	// mmu registers are above
+#define UNPACK_START	0x1300	// unpack image, see bootcode.s (LOADER_ADDR)
+#define UNPACK_END	0x1800	// must match bootcode.s
+#define IO_START	0xd000	// i/o area in default bank 15
+#define IO_END		0xe000
+#define UNPACKED_MAX	0xe000	// more would not fit into bank 0 anyway
+#define LITERAL_MAX	127
+#define TOKEN_END	0x7f
+#define SHORT_MIN	2
+#define SHORT_MAX	65
+#define SHORT_OFFSET	256
+#define LONG_MIN	3
+#define LONG_MAX	66
+#define LONG_OFFSET	65536
+#define CHAIN_MAX	4096	// how many candidates to check per position
+// for load time estimate:
+#define BLOCK_DATA	254	// data bytes per block
+#define KERNAL_BPS	400	// bytes per second, kernal load from 1541
+#define DECRUNCH_CPB	40	// cycles per unpacked byte, roughly
+#define MOVE_CPB	16	// cycles per packed byte, for moving stream
+#define CLOCK		2000000	// decruncher runs in FAST mode
+
+static uint8_t	in[UNPACKED_MAX];
+static size_t	in_len;
+static uint8_t	out[UNPACKED_MAX * 2];
+static size_t	out_len;
+static size_t	literal_start;	// index in "in" of pending literals
+static long	safety;	// max. of (written - read), see sfx.s
+// hash chains to find matches:
+#define HASH_SIZE	4096
+static int	head[HASH_SIZE];
+static int	prev[UNPACKED_MAX];
+
+static void __attribute__((noreturn)) fail(const char *msg, const char *arg)
+{
+	fprintf(stderr, "pack: %s%s\n", msg, arg);
+	exit(EXIT_FAILURE);
+}
+
+static long file_size(const char *name)
+{
+	FILE	*fd;
+	long	size;
+
+	fd = fopen(name, "rb");
+	if (fd == NULL)
+		fail("cannot open ", name);
+	fseek(fd, 0, SEEK_END);
+	size = ftell(fd);
+	fclose(fd);
+	return size;
+}
+
+static unsigned int hash(size_t pos)
+{
+	return ((in[pos] << 4) ^ (in[pos + 1] << 2) ^ in[pos + 2]) % HASH_SIZE;
+}
+
+// add position to hash chains
+static void insert(size_t pos)
+{
+	unsigned int	hh;
+
+	if (pos + 2 >= in_len)
+		return;
+	hh = hash(pos);
+	prev[pos] = head[hh];
+	head[hh] = pos;
+}
+
+// find longest match for position, return length (0 if none is worth it)
+static size_t find_match(size_t pos, size_t *offset)
+{
+	int	cand;
+	size_t	len,
+		best_len	= 0,
+		max		= in_len - pos,
+		chain		= CHAIN_MAX;
+
+	*offset = LONG_OFFSET + 1;
+	if (max < LONG_MIN)
+		return 0;
+	if (max > LONG_MAX)
+		max = LONG_MAX;
+	for (cand = head[hash(pos)]; cand >= 0 && chain--; cand = prev[cand]) {
+		if (pos - cand > LONG_OFFSET)
+			break;
+		for (len = 0; len < max && in[cand + len] == in[pos + len]; ++len)
+			;
+		// short matches are cheaper, so prefer them if just as long
+		if (len > best_len || (len == best_len && len && pos - cand <= SHORT_OFFSET && *offset > SHORT_OFFSET)) {
+			best_len = len;
+			*offset = pos - cand;
+		}
+	}
+	// short match costs two bytes, long one three
+	if (best_len >= SHORT_MIN + 1 && *offset <= SHORT_OFFSET)
+		return best_len;
+	if (best_len >= LONG_MIN + 1)
+		return best_len;
+	return 0;
+}
+
+// remember how far writing gets ahead of reading
+static void check_safety(size_t written)
+{
+	if ((long) written - (long) out_len > safety)
+		safety = (long) written - (long) out_len;
+}
+
+// emit pending literals up to position
+static void flush_literals(size_t pos)
+{
+	size_t	len;
+
+	while (literal_start < pos) {
+		len = pos - literal_start;
+		if (len > LITERAL_MAX)
+			len = LITERAL_MAX;
+		out[out_len++] = len - 1;
+		memcpy(out + out_len, in + literal_start, len);
+		out_len += len;
+		literal_start += len;
+		check_safety(literal_start);
+	}
+}
+
+static void emit_match(size_t pos, size_t len, size_t offset)
+{
+	flush_literals(pos);
+	if (offset <= SHORT_OFFSET && len <= SHORT_MAX) {
+		out[out_len++] = 0x80 | (len - SHORT_MIN);
+		out[out_len++] = offset - 1;
+	} else {
+		out[out_len++] = 0xc0 | (len - LONG_MIN);
+		out[out_len++] = (offset - 1) & 255;
+		out[out_len++] = (offset - 1) >> 8;
+	}
+	literal_start = pos + len;
+	check_safety(literal_start);
+}
+
+// greedy parsing with one step lookahead
+static void pack(void)
+{
+	size_t	pos	= 0,
+		len,
+		next_len,
+		offset,
+		next_offset;
+
+	memset(head, -1, sizeof(head));
+	while (pos < in_len) {
+		len = find_match(pos, &offset);
+		if (len) {
+			insert(pos);
+			next_len = find_match(pos + 1, &next_offset);
+			if (next_len > len + 1) {
+				++pos;	// literal now, better match next
+				continue;
+			}
+			emit_match(pos, len, offset);
+			while (--len)
+				insert(++pos);
+			++pos;
+		} else {
+			insert(pos++);
+		}
+	}
+	flush_literals(pos);
+	out[out_len++] = TOKEN_END;
+}
+
+// get address from "sys" line
+static unsigned int entry_from_sys_line(void)
+{
+	size_t		ii;
+	unsigned int	entry	= 0;
+
+	// skip link pointer and line number
+	for (ii = 4; ii < in_len && in[ii] == ' '; ++ii)
+		;
+	if (ii >= in_len || in[ii] != 0x9e)	// "sys" token
+		fail("program does not start with a sys line", "");
+	for (++ii; ii < in_len && in[ii] == ' '; ++ii)
+		;
+	while (ii < in_len && in[ii] >= '0' && in[ii] <= '9')
+		entry = entry * 10 + in[ii++] - '0';
+	if (entry < LOAD_ADDR || entry >= LOAD_ADDR + in_len)
+		fail("sys address is outside of program", "");
+	return entry;
+}
+
+static long blocks(long size)
+{
+	return (size + BLOCK_DATA - 1) / BLOCK_DATA;
+}
+
+// compare original and packed program
+static void report(const char *old_name, const char *new_name)
+{
+	long	old_size	= file_size(old_name),
+		new_size	= file_size(new_name),
+		old_blocks	= blocks(old_size),
+		new_blocks	= blocks(new_size);
+
+	// decrunch time is estimated from sizes, the load address is not counted
+	printf("%s: %ld blocks, %s: %ld blocks (%ld blocks less)\n",
+		old_name, old_blocks, new_name, new_blocks, old_blocks - new_blocks);
+	printf("estimated kernal load time from 1541: %.1f s -> %.1f s, plus %.1f s to decrunch\n",
+		(double) old_size / KERNAL_BPS, (double) new_size / KERNAL_BPS,
+		((double) (old_size - 2) * DECRUNCH_CPB + (double) new_size * MOVE_CPB) / CLOCK);
+}
+
+// check whether memory areas overlap (ends are exclusive)
+static bool overlaps(unsigned long start, unsigned long end, unsigned long area_start, unsigned long area_end)
+{
+	return start < area_end && area_start < end;
+}
+
+// write file for "packed prg" boot action
+static void write_packed_prg(const char *name, unsigned int dest)
+{
+	FILE		*fd;
+	unsigned long	load;
+	uint8_t		header[4];
+
+	// stream must start at least "safety" bytes after destination
+	load = dest + (safety > 0 ? safety : 0) - 2;
+	if (load + 2 + out_len > MEMORY_END)
+		fail("program too large to decrunch in place: ", name);
+	// neither the loaded file nor the unpacked program may hit the unpack
+	// image or the i/o area (the program is loaded and run in the chosen
+	// bank, which is usually 15)
+	if (overlaps(load, load + 2 + out_len, UNPACK_START, UNPACK_END)
+	|| overlaps(dest, dest + in_len, UNPACK_START, UNPACK_END))
+		fail("program would overwrite unpack code at $1300-$17ff: ", name);
+	if (overlaps(load, load + 2 + out_len, IO_START, IO_END)
+	|| overlaps(dest, dest + in_len, IO_START, IO_END))
+		fail("program would reach i/o area at $d000-$dfff: ", name);
+	header[0] = load & 255;
+	header[1] = load >> 8;
+	header[2] = dest & 255;
+	header[3] = dest >> 8;
+	fd = fopen(name, "wb");
+	if (fd == NULL)
+		fail("cannot create ", name);
+	if (fwrite(header, 1, 4, fd) != 4 || fwrite(out, 1, out_len, fd) != out_len)
+		fail("cannot write ", name);
+	fclose(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	static uint8_t	load[2];
+	FILE		*fd;
+	unsigned int	dest,
+			entry;
+	bool		prg	= 0;
+
+	if (argc == 4 && strcmp(argv[1], "-r") == 0) {
+		report(argv[2], argv[3]);
+		return EXIT_SUCCESS;
+	}
+	if (argc == 4 && strcmp(argv[1], "-p") == 0) {
+		prg = 1;
+		++argv;
+		--argc;
+	}
+	if (argc != 3) {
+		fprintf(stderr, "usage: pack INFILE OUTFILE\n       pack -p INFILE OUTFILE\n       pack -r OLDFILE NEWFILE\n");
+		return EXIT_FAILURE;
+	}
+	fd = fopen(argv[1], "rb");
+	if (fd == NULL)
+		fail("cannot open ", argv[1]);
+	if (fread(load, 1, 2, fd) != 2)
+		fail("file too short: ", argv[1]);
+	dest = load[0] + 256 * load[1];
+	if (!prg && dest != LOAD_ADDR)
+		fail("load address must be $1c01: ", argv[1]);
+	in_len = fread(in, 1, sizeof(in), fd);
+	if (fgetc(fd) != EOF || dest + in_len > MEMORY_END)
+		fail("file too large: ", argv[1]);
+	fclose(fd);
+	if (prg) {
+		pack();
+		write_packed_prg(argv[2], dest);
+		fprintf(stderr, "pack: %lu -> %lu bytes\n", (unsigned long) in_len, (unsigned long) out_len + 2);
+		return EXIT_SUCCESS;
+	}
+	entry = entry_from_sys_line();
+	pack();
+	fd = fopen(argv[2], "wb");
+	if (fd == NULL)
+		fail("cannot create ", argv[2]);
+	if (fwrite(out, 1, out_len, fd) != out_len)
+		fail("cannot write ", argv[2]);
+	fclose(fd);
+	// parameters for sfx.s
+	printf("; generated by pack, do not edit\n");
+	printf("PACKED_LEN\t= %lu\n", (unsigned long) out_len);
+	printf("UNPACKED_LEN\t= %lu\n", (unsigned long) in_len);
+	printf("SAFETY\t\t= %ld\t; decrunch fails if stream starts lower than LOAD_ADDR + this\n", safety);
+	printf("ENTRY\t\t= %u\n", entry);
+	fprintf(stderr, "pack: %lu -> %lu bytes\n", (unsigned long) in_len, (unsigned long) out_len);
+	return EXIT_SUCCESS;
+}
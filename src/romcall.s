@@ -0,0 +1,30 @@
+; MacBootMake ROM call trampoline
+;
+; BASIC 7 routines need the full ROMs at $4000-$ffff, which hide the RAM
+; there. so the code switching to them must be below $4000: it goes to
+; LOWCODE, which macbootmake.cfg puts right after the startup code. the
+; rest of the program can then be anywhere.
+
+		.export	_call_basic_rom
+
+MMU_CR		= $ff00		; 0 means full ROMs
+
+		.segment	"LOWCODE"
+
+; void __fastcall__ call_basic_rom(int address)
+_call_basic_rom:
+		sta	target
+		stx	target + 1
+		lda	MMU_CR
+		pha
+		lda	#0
+		sta	MMU_CR		; full ROMs
+		jsr	jump
+		pla
+		sta	MMU_CR
+		rts
+
+jump:		jmp	$ffff		; address gets patched
+target		= jump + 1
+
+		.assert	* <= $4000, lderror, "ROM call trampoline must be below $4000"
@@ -0,0 +1,112 @@
+; self-decrunching wrapper for macbootmake, see pack.c for stream format
+; and decrunch.inc for the decruncher
+;
+; the file is a basic program with a "sys" line, followed by the decruncher
+; and the packed stream. the decruncher gets copied to RELOC_ADDR, moves the
+; stream to the end of bank 0, decrunches it to LOAD_ADDR in FAST mode with
+; blanked vic display, restores everything and then jumps to the address
+; from the original program's "sys" line, so it starts just like before.
+
+		.include	"_packed.tmp.inc"	; written by pack
+
+LOAD_ADDR	= $1c01		; c128 basic start
+RELOC_ADDR	= $1300		; free until the program uses it
+STREAM_END	= $ff00		; end of stream after moving it (mmu is above)
+; mmu configuration
+CR_RAM0		= $3f		; RAM0 only
+; zero page
+src		= $fb		; read pointer (two bytes)
+dst		= $fd		; write pointer (two bytes)
+match		= $24		; read pointer for matches (two bytes, basic temp)
+; i/o
+VIC_CR1		= $d011		; bit 4 enables display
+VIC_CLKRATE	= $d030		; bit 0 selects 2 MHz
+MMU_CR		= $ff00		; configuration register
+
+STREAM_START	= STREAM_END - PACKED_LEN
+		.assert	STREAM_START >= LOAD_ADDR + SAFETY, error, "program too large to decrunch in place"
+
+		.word	LOAD_ADDR	; load address
+		.org	LOAD_ADDR
+		.word	basic_end, 2026	; link pointer, line number
+		.byte	$9e, "7181", 0	; sys
+basic_end:	.word	0
+		.assert	* = 7181, error, "sys address does not match"
+
+		sei
+		ldx	#0
+:			lda	reloc_store, x
+			sta	RELOC_ADDR, x
+			inx
+			cpx	#RELOC_SIZE
+			bne	:-
+		jmp	relocated
+
+reloc_store:
+		.org	RELOC_ADDR
+RELOC_OFFSET	= reloc_store - RELOC_ADDR
+
+relocated:	lda	MMU_CR
+		sta	old_cr
+		lda	VIC_CR1
+		sta	old_cr1
+		and	#$ef
+		sta	VIC_CR1		; blank display, so FAST mode is clean
+		lda	VIC_CLKRATE
+		sta	old_clkrate
+		ora	#1
+		sta	VIC_CLKRATE
+		lda	#CR_RAM0	; no roms, no i/o
+		sta	MMU_CR
+		; move stream to end of bank 0. this is done backwards in whole
+		; pages, because areas may overlap (some bytes from before the
+		; stream get copied as well, which does not hurt)
+		lda	#<(stream + PACKED_LEN - 256)
+		ldx	#>(stream + PACKED_LEN - 256)
+		sta	src
+		stx	src + 1
+		lda	#<(STREAM_END - 256)
+		ldx	#>(STREAM_END - 256)
+		sta	dst
+		stx	dst + 1
+		ldx	#>(PACKED_LEN + 255)	; number of pages
+		ldy	#0
+@page:			dey
+			lda	(src), y
+			sta	(dst), y
+			tya
+			bne	@page
+			dec	src + 1
+			dec	dst + 1
+			dex
+			bne	@page
+		lda	#<STREAM_START
+		ldx	#>STREAM_START
+		sta	src
+		stx	src + 1
+		lda	#<LOAD_ADDR
+		ldx	#>LOAD_ADDR
+		sta	dst
+		stx	dst + 1
+		jsr	decrunch
+		lda	old_cr
+		sta	MMU_CR		; i/o is back
+		lda	old_clkrate
+		sta	VIC_CLKRATE
+		lda	old_cr1
+		sta	VIC_CR1
+		cli
+		jmp	ENTRY
+
+		.include	"decrunch.inc"
+
+old_cr:		.byte	0	; original mmu configuration,
+old_cr1:	.byte	0	;	vic control register 1
+old_clkrate:	.byte	0	;	and clock rate
+reloc_end:
+RELOC_SIZE	= reloc_end - RELOC_ADDR
+		.assert	RELOC_SIZE <= 256, error, "relocated part too large"
+		.org	reloc_store + RELOC_SIZE
+
+stream:		.incbin	"_packed.tmp"
+		.assert	* <= STREAM_END, error, "program too large to move stream"
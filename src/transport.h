@@ -0,0 +1,35 @@
+// drive access for the boot block core (see bbcore.h).
+//
+// a transport behaves like a cbm disk drive with a command channel and one
+// buffer channel ("#"): the core sends dos commands ("u1", "u2", "b-p",
+// "b-a", "b-f") in petscii, just like a real drive would see them, and
+// reads/writes the buffer. so a transport can either pass everything on to
+// a drive (like the kernal transport in macbootmake.c) or emulate the few
+// commands on something else (like the disc image transport in d64.c).
+// all functions that return bool return true on error, after reporting it.
+#ifndef transport_H
+#define transport_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// secondary address of buffer channel, as used in block commands
+#define SA_BUF		2	// could be anything in 2..14 range
+
+struct transport {
+	// open command channel (initialising drive) and buffer channel
+	bool	(*open)(void);
+	// close both channels
+	void	(*close)(void);
+	// return first byte of raw directory (dos format indicator), or -1
+	int	(*format)(void);
+	// send command to command channel
+	bool	(*command)(const char *cmd, uint8_t len);
+	// read and display status, also fails if drive reports an error
+	bool	(*status)(void);
+	// read from/write to buffer channel, short transfers are errors too
+	bool	(*read)(void *data, uint16_t len);
+	bool	(*write)(const void *data, uint16_t len);
+};
+
+#endif